@@ -14,7 +14,9 @@ CFLAGS += -pedantic -Wall -W -Wno-unused-parameter -Os -g3 -std=gnu99 -DGIT_REV=
 # CFLAGS += -DTEST_LINK_ID_COLLISION_DETECTION
 # CFLAGS += -DTEST_DEBUG          # (testing syntax of __VA_ARGS__ dbg...() macros)
 # CFLAGS += -DTEST_DEBUG_MALLOC   # allocates a never freed byte which should be reported at bmx6 termination
-# CFLAGS += -DAVL_5XLINKED -DAVL_DEBUG -DAVL_TEST
+# CFLAGS += -DAVL_DEBUG -DAVL_TEST  # avl tests: bmx6 --treeFuzz 10000, bmx6 --treeBench 100000
+# CFLAGS += -DSCHEDULE_TEST       # scheduling tests: bmx6 --timerTest, bmx6 --timerBench 10000, bmx6 dev=eth0 --rxFairnessTest
+# CFLAGS += -DMALLOC_TEST         # allocator benchmarks: bmx6 --mallocBench 10000, bmx6 --mallocChurn 100000
 
 # optional defines (you may disable these features if you dont need them)
 # CFLAGS += -DNO_DEBUG_TRACK
@@ -22,12 +24,14 @@ CFLAGS += -pedantic -Wall -W -Wno-unused-parameter -Os -g3 -std=gnu99 -DGIT_REV=
 # CFLAGS += -DLESS_OPTIONS
 # CFLAGS += -DNO_DYN_PLUGIN
 # CFLAGS += -DNO_TRACE_FUNCTION_CALLS
+# CFLAGS += -DMEMORY_POOLS        # (allocate small objects from slab pools instead of malloc())
+# CFLAGS += -DNO_AVL_5XLINKED     # (saves two pointers per avl node, but avl_iterate_item() climbs up pointers)
 
 # CFLAGS += -DDEBUG_ALL
 # CFLAGS += -DTRAFFIC_DUMP
 # CFLAGS += -DDEBUG_DUMP
 CFLAGS += -DDEBUG_MALLOC
-# CFLAGS += -DMEMORY_USAGE
+CFLAGS += -DMEMORY_USAGE
 
 # experimental or advanced defines (please dont touch):
 # CFLAGS += -DNO_ASSERTIONS       # (disable syntax error checking and error-code creation!)
@@ -53,18 +57,25 @@ CFLAGS += -DDEBUG_MALLOC
 
 LDFLAGS += -g3
 
+LDFLAGS += -lpthread
+
 LDFLAGS += $(shell echo "$(CFLAGS) $(EXTRA_CFLAGS)" | grep -q "DNO_DYNPLUGIN" || echo "-Wl,-export-dynamic -ldl" )
 LDFLAGS += $(shell echo "$(CFLAGS) $(EXTRA_CFLAGS)" | grep -q "DPROFILING" && echo "-pg -lc" )
 
 SBINDIR = $(INSTALL_PREFIX)/usr/sbin
 
-SRC_C = bmx.c msg.c metrics.c tools.c plugin.c list.c allocate.c avl.c iid.c hna.c control.c schedule.c ip.c cyassl/sha.c cyassl/random.c cyassl/arc4.c
-SRC_H = bmx.h msg.h metrics.h tools.h plugin.h list.h allocate.h avl.h iid.h hna.h control.h schedule.h ip.h cyassl/sha.h cyassl/random.h cyassl/arc4.h
+SRC_C = bmx.c msg.c metrics.c tools.c plugin.c list.c allocate.c avl.c hash.c iid.c hna.c control.c schedule.c ip.c cyassl/sha.c cyassl/random.c cyassl/arc4.c
+SRC_H = bmx.h msg.h metrics.h tools.h plugin.h list.h allocate.h avl.h hash.h iid.h hna.h control.h schedule.h ip.h cyassl/sha.h cyassl/random.h cyassl/arc4.h
 
 SRC_C += $(shell echo "$(CFLAGS) $(EXTRA_CFLAGS)" | grep -q "DTRAFFIC_DUMP" && echo dump.c )
 SRC_H += $(shell echo "$(CFLAGS) $(EXTRA_CFLAGS)" | grep -q "DTRAFFIC_DUMP" && echo dump.h )
 
 OBJS = $(SRC_C:.c=.o)
 
+# standalone benchmarks of core data structures (make bench), needing neither root nor network:
+BENCH_SRC_C = bench.c avl.c hash.c list.c iid.c tools.c metrics.c allocate.c
+BENCH_OBJS = $(BENCH_SRC_C:.c=.o)
+
 PACKAGE_NAME := bmx6
 BINARY_NAME  := bmx6
+BENCH_NAME   := bmx6_bench
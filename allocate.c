@@ -21,20 +21,172 @@
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include "bmx.h"
+#include "tools.h"
+
+
+#ifdef MEMORY_POOLS
+
+/*
+ * Size-class slab pools for small objects (avl nodes, task nodes, router nodes, ...) which are allocated
+ * and freed at high rates. Each class keeps its slabs with free objects in a list, a slab is found from any
+ * of its objects by address alignment. Completely unused slabs are returned to the system unless
+ * it is the last one with free objects of its class, so churn neither grows nor fragments the heap.
+ * Objects larger than POOL_CLASS_MAX bytes are passed to malloc().
+ */
+
+struct pool_slab {
+	struct pool_slab *next; // in the partial list of its class
+	struct pool_slab *prev;
+	void *free;             // singly-linked free objects of this slab
+	uint16_t used;
+	uint16_t cls;
+};
+
+struct pool_class {
+	struct pool_slab *partial; // slabs with free objects
+	uint32_t slabs;
+	uint32_t used;
+};
+
+static struct pool_class pool_classes[POOL_CLASSES];
+
+#define POOL_CLASS(size) (((size) - 1) / POOL_CLASS_STEP)
+#define POOL_OBJECTS_OFFSET ((sizeof (struct pool_slab) + (POOL_CLASS_STEP - 1)) & ~(POOL_CLASS_STEP - 1))
+
+STATIC_FUNC
+void pool_partial_add(struct pool_class *pc, struct pool_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = pc->partial;
+
+	if (pc->partial)
+		pc->partial->prev = slab;
+
+	pc->partial = slab;
+}
+
+STATIC_FUNC
+void pool_partial_del(struct pool_class *pc, struct pool_slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		pc->partial = slab->next;
+
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+STATIC_FUNC
+struct pool_slab *pool_slab_create(uint16_t cls)
+{
+	struct pool_slab *slab;
+	int32_t size = (cls + 1) * POOL_CLASS_STEP;
+	int32_t pos;
+
+	if (posix_memalign((void**) &slab, POOL_SLAB_SIZE, POOL_SLAB_SIZE))
+		return NULL;
+
+	slab->free = NULL;
+	slab->used = 0;
+	slab->cls = cls;
+
+	for (pos = POOL_SLAB_SIZE - size; pos >= (int32_t) POOL_OBJECTS_OFFSET; pos -= size) {
+		void **obj = (void**) (((uint8_t*) slab) + pos);
+		*obj = slab->free;
+		slab->free = obj;
+	}
+
+	pool_classes[cls].slabs++;
+	pool_partial_add(&pool_classes[cls], slab);
+
+	return slab;
+}
+
+STATIC_FUNC
+void *pool_alloc(uint32_t size)
+{
+	if (size > POOL_CLASS_MAX)
+		return malloc(size);
+
+	uint16_t cls = POOL_CLASS(size);
+	struct pool_class *pc = &pool_classes[cls];
+	struct pool_slab *slab = pc->partial ? pc->partial : pool_slab_create(cls);
+
+	if (!slab)
+		return NULL;
+
+	void **obj = slab->free;
+
+	slab->free = *obj;
+	slab->used++;
+	pc->used++;
+
+	if (!slab->free)
+		pool_partial_del(pc, slab);
+
+	return obj;
+}
+
+STATIC_FUNC
+void pool_free(void *mem, uint32_t size)
+{
+	if (size > POOL_CLASS_MAX) {
+		free(mem);
+		return;
+	}
+
+	struct pool_slab *slab = (struct pool_slab *) (((uintptr_t) mem) & ~((uintptr_t) (POOL_SLAB_SIZE - 1)));
+	struct pool_class *pc = &pool_classes[POOL_CLASS(size)];
+
+	assertion(-501590, (slab->cls == POOL_CLASS(size) && slab->used));
+
+	if (!slab->free)
+		pool_partial_add(pc, slab);
+
+	*((void**) mem) = slab->free;
+	slab->free = mem;
+	slab->used--;
+	pc->used--;
+
+	if (!slab->used && (slab->prev || slab->next)) {
+		pool_partial_del(pc, slab);
+		pc->slabs--;
+		free(slab);
+	}
+}
+
+#else
+
+#define pool_alloc( size ) malloc( (size) )
+#define pool_free( mem, size ) free( (mem) )
+
+#endif
+
 
 #ifdef DEBUG_MALLOC
 
 #define MAGIC_NUMBER_HEADER 0xB2B2B2B2
+#define MAGIC_NUMBER_FREED 0xB2DEADB2
 #define MAGIC_NUMBER_TRAILOR 0xB2
 
 
+/*
+ * All allocated chunks are kept in a doubly-linked list so that _debugFree() can unlink them in O(1).
+ * A chunk is verified as allocated by checking that its neighbours point back to it,
+ * freed chunks get MAGIC_NUMBER_FREED to tell double frees from corrupted headers.
+ */
 struct chunkHeader *chunkList = NULL;
 
 struct chunkHeader
 {
 	struct chunkHeader *next;
+	struct chunkHeader *prev;
 	uint32_t length;
 	int32_t tag;
         uint32_t magicNumberHeader;
@@ -45,128 +197,345 @@ typedef unsigned char MAGIC_TRAILER_T;
 
 #ifdef MEMORY_USAGE
 
-struct memoryUsage *memoryList = NULL;
-
-
+/*
+ * Per-tag accounting of current and peak objects and bytes. Tags of the core range are direct-indexed,
+ * others are kept in a small open-addressing hash, so each malloc and free costs O(1).
+ */
 struct memoryUsage
 {
-	struct memoryUsage *next;
-	uint32_t length;
-	uint32_t counter;
 	int32_t tag;
+	uint32_t counter;
+	uint32_t counterMax;
+	uint32_t allocs;
+	uint64_t bytes;
+	uint64_t bytesMax;
 };
 
-void addMemory(uint32_t length, int32_t tag)
+static struct memoryUsage memoryDirect[MEMORY_TAGS_DIRECT];
+static struct memoryUsage memoryHashed[MEMORY_TAGS_HASHED];
+static struct memoryUsage memoryTotal;
+
+STATIC_FUNC
+struct memoryUsage *getMemoryUsage(int32_t tag, uint8_t create)
 {
+	uint32_t i = ((uint32_t) MEMORY_TAG_BASE) - ((uint32_t) tag);
+	uint32_t n;
 
-	struct memoryUsage *walker;
+	if (i < MEMORY_TAGS_DIRECT)
+		return (memoryDirect[i].allocs || create) ? &memoryDirect[i] : NULL;
 
-	for ( walker = memoryList; walker != NULL; walker = walker->next ) {
+	for (i = (((uint32_t) tag) * 2654435761U) % MEMORY_TAGS_HASHED, n = 0; n < MEMORY_TAGS_HASHED; n++, i = (i + 1) % MEMORY_TAGS_HASHED) {
 
-		if ( walker->tag == tag ) {
+		if (memoryHashed[i].allocs && memoryHashed[i].tag == tag)
+			return &memoryHashed[i];
 
-			walker->counter++;
-			break;
-		}
+		if (!memoryHashed[i].allocs)
+			return create ? &memoryHashed[i] : NULL;
 	}
 
-	if ( walker == NULL ) {
+	return NULL;
+}
 
-		walker = malloc( sizeof(struct memoryUsage) );
+STATIC_FUNC
+void addMemoryUsage(struct memoryUsage *mu, uint32_t length)
+{
+	mu->counter++;
+	mu->allocs++;
+	mu->bytes += length;
+	mu->counterMax = XMAX(mu->counterMax, mu->counter);
+	mu->bytesMax = XMAX(mu->bytesMax, mu->bytes);
+}
 
-		walker->length = length;
-		walker->tag = tag;
-		walker->counter = 1;
+void addMemory(uint32_t length, int32_t tag)
+{
+	struct memoryUsage *mu = getMemoryUsage(tag, YES);
 
-		walker->next = memoryList;
-		memoryList = walker;
+	if (!mu) {
+		dbg_sys(DBGT_ERR, "Too many malloc tags, malloc tag = %d", tag);
+		cleanup_all(-501591);
 	}
 
+	mu->tag = tag;
+	addMemoryUsage(mu, length);
+	addMemoryUsage(&memoryTotal, length);
 }
 
-void removeMemory(int32_t tag, int32_t freetag)
+void removeMemory(uint32_t length, int32_t tag, int32_t freetag)
 {
+	struct memoryUsage *mu = getMemoryUsage(tag, NO);
 
-	struct memoryUsage *walker;
+	if ( mu == NULL ) {
 
-	for ( walker = memoryList; walker != NULL; walker = walker->next ) {
+                dbg_sys(DBGT_ERR, "Freeing memory that was never allocated: malloc tag = %d, free tag = %d",
+		     tag, freetag );
+		cleanup_all( -500070 );
+	}
 
-		if ( walker->tag == tag ) {
+	if ( mu->counter == 0 ) {
 
-			if ( walker->counter == 0 ) {
+		dbg_sys(DBGT_ERR, "Freeing more memory than was allocated: malloc tag = %d, free tag = %d",
+		     tag, freetag );
+		cleanup_all( -500069 );
+	}
 
-                                dbg_sys(DBGT_ERR, "Freeing more memory than was allocated: malloc tag = %d, free tag = %d",
-				     tag, freetag );
-				cleanup_all( -500069 );
+	mu->counter--;
+	mu->bytes -= length;
+	memoryTotal.counter--;
+	memoryTotal.bytes -= length;
+}
 
-			}
+STATIC_FUNC
+struct memoryUsage *iterateMemoryUsage(uint32_t *pos)
+{
+	while (*pos < MEMORY_TAGS_DIRECT + MEMORY_TAGS_HASHED) {
 
-			walker->counter--;
-			break;
+		struct memoryUsage *mu = (*pos < MEMORY_TAGS_DIRECT) ?
+			&memoryDirect[*pos] : &memoryHashed[*pos - MEMORY_TAGS_DIRECT];
 
-		}
+		(*pos)++;
 
+		if (mu->allocs)
+			return mu;
 	}
 
-	if ( walker == NULL ) {
-
-                dbg_sys(DBGT_ERR, "Freeing memory that was never allocated: malloc tag = %d, free tag = %d",
-		     tag, freetag );
-		cleanup_all( -500070 );
-	}
+	return NULL;
 }
 
 void debugMemory(struct ctrl_node *cn)
 {
 
-	struct memoryUsage *memoryWalker;
+	struct memoryUsage *mu;
+	uint32_t pos = 0;
 
 	dbg_printf( cn, "\nMemory usage information:\n" );
 
-	for ( memoryWalker = memoryList; memoryWalker != NULL; memoryWalker = memoryWalker->next ) {
+	while ((mu = iterateMemoryUsage(&pos))) {
 
-		if ( memoryWalker->counter != 0 )
-			dbg_printf( cn, "   tag: %4i, num malloc: %4i, bytes per malloc: %4i, total: %6i\n",
-			         memoryWalker->tag, memoryWalker->counter, memoryWalker->length,
-			         memoryWalker->counter * memoryWalker->length );
+		if ( mu->counter != 0 )
+			dbg_printf( cn, "   tag: %4i, num malloc: %4i, total: %6ju, max: %6ju\n",
+			         mu->tag, mu->counter, (uintmax_t) mu->bytes, (uintmax_t) mu->bytesMax );
 
 	}
 	dbg_printf( cn, "\n" );
 
 }
 
+struct memory_status {
+        char tag[12];
+        uint32_t objects;
+        uint32_t objectsMax;
+        uint32_t bytes;
+        uint32_t bytesMax;
+        uint32_t allocs;
+};
+
+static const struct field_format memory_status_format[] = {
+        FIELD_FORMAT_INIT(FIELD_TYPE_STRING_CHAR,       memory_status, tag,         1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              memory_status, objects,     1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              memory_status, objectsMax,  1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              memory_status, bytes,       1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              memory_status, bytesMax,    1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              memory_status, allocs,      1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_END
+};
+
+STATIC_FUNC
+void memory_status_set(struct memory_status *status, struct memoryUsage *mu, char *tag)
+{
+        if (tag)
+                snprintf(status->tag, sizeof (status->tag), "%s", tag);
+        else
+                snprintf(status->tag, sizeof (status->tag), "%d", mu->tag);
+
+        status->objects = mu->counter;
+        status->objectsMax = mu->counterMax;
+        status->bytes = mu->bytes;
+        status->bytesMax = mu->bytesMax;
+        status->allocs = mu->allocs;
+}
+
+STATIC_FUNC
+int32_t memory_status_creator(struct status_handl *handl, void *data)
+{
+        struct memoryUsage *mu;
+        uint32_t pos = 0, rows = 1/*total*/, i = 0;
+
+        while (iterateMemoryUsage(&pos))
+                rows++;
+
+        // the status data itself is accounted, so count it before creating the rows:
+        struct memory_status *status = (struct memory_status *) (handl->data =
+                debugRealloc(handl->data, (rows + 1) * sizeof (struct memory_status), -300594));
+
+        memset(status, 0, (rows + 1) * sizeof (struct memory_status));
+
+        for (pos = 0; (mu = iterateMemoryUsage(&pos)) && i < rows;)
+                memory_status_set(&status[i++], mu, NULL);
+
+        memory_status_set(&status[i++], &memoryTotal, "total");
+
+        return i * sizeof (struct memory_status);
+}
+
+void init_memory_usage(void)
+{
+        register_status_handl(sizeof (struct memory_status), 1, memory_status_format, ARG_MEMORY, memory_status_creator);
+}
+
 #endif //#ifdef MEMORY_USAGE
 
 
-void checkIntegrity(void)
+STATIC_FUNC
+void checkChunkIntegrity(struct chunkHeader *walker)
 {
-	struct chunkHeader *walker;
 	MAGIC_TRAILER_T *chunkTrailer;
 	unsigned char *memory;
 
+	if (walker->magicNumberHeader != MAGIC_NUMBER_HEADER)
+{
+                dbgf_sys(DBGT_ERR, "invalid magic number in header: %08x, malloc tag = %d",
+		     walker->magicNumberHeader, walker->tag );
+		cleanup_all( -500073 );
+	}
+
+	memory = (unsigned char *)walker;
+
+	chunkTrailer = (MAGIC_TRAILER_T*)(memory + sizeof(struct chunkHeader) + walker->length);
+
+	if (*chunkTrailer != MAGIC_NUMBER_TRAILOR)
+{
+                dbgf_sys(DBGT_ERR, "invalid magic number in trailer: %08x, malloc tag = %d",
+		     *chunkTrailer, walker->tag );
+		cleanup_all( -500075 );
+	}
+}
+
+void checkIntegrity(void)
+{
+	struct chunkHeader *walker;
+
 //        dbgf_all(DBGT_INFO, " ");
 
 	for (walker = chunkList; walker != NULL; walker = walker->next)
-	{
-		if (walker->magicNumberHeader != MAGIC_NUMBER_HEADER)
+		checkChunkIntegrity(walker);
+
+}
+
+
+/*
+ * Incremental integrity checking: each call of checkIntegritySlice() continues a cursor through the chunkList
+ * until the given time budget is used, so the whole heap is still covered every few main-loop iterations
+ * without a single long stall. _debugFree() advances the cursor when it frees the chunk it points to.
+ * Chunks allocated during a cycle are inserted at the list head and are covered by the next one.
+ */
+static struct chunkHeader *integrityCursor = NULL;
+static TIME_T integrityCycleStart = 0;
+
+static struct {
+	uint32_t cycles;
+	uint32_t chunks;       // of current cycle
+	uint32_t slices;       // of current cycle
+	uint32_t lastChunks;
+	uint32_t lastSlices;
+	uint32_t lastPeriod;   // ms between the start of the last two cycles
+	uint32_t lastDuration; // ms from start to end of the last cycle
+	uint32_t sliceMaxUs;
+} integrity_stats;
+
+STATIC_FUNC
+uint64_t integrity_time_us(void)
 {
-                        dbgf_sys(DBGT_ERR, "invalid magic number in header: %08x, malloc tag = %d",
-			     walker->magicNumberHeader, walker->tag );
-			cleanup_all( -500073 );
-		}
+	struct timespec now;
 
-		memory = (unsigned char *)walker;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-		chunkTrailer = (MAGIC_TRAILER_T*)(memory + sizeof(struct chunkHeader) + walker->length);
+	return (((uint64_t) now.tv_sec) * 1000000) + (now.tv_nsec / 1000);
+}
 
-		if (*chunkTrailer != MAGIC_NUMBER_TRAILOR)
+void checkIntegritySlice(uint32_t budget_us)
 {
-                        dbgf_sys(DBGT_ERR, "invalid magic number in trailer: %08x, malloc tag = %d",
-			     *chunkTrailer, walker->tag );
-			cleanup_all( -500075 );
-		}
+	uint64_t start_us, now_us;
+	uint32_t n = 0;
+
+	if (!integrityCursor) {
+
+		if (!chunkList || (integrity_stats.cycles && U32_LT(bmx_time, integrityCycleStart + INTEGRITY_CYCLE_MIN_MS)))
+			return;
+
+		if (integrity_stats.cycles)
+			integrity_stats.lastPeriod = bmx_time - integrityCycleStart;
+
+		integrityCycleStart = bmx_time;
+		integrityCursor = chunkList;
+	}
+
+	now_us = start_us = integrity_time_us();
+
+	while (integrityCursor) {
+
+		checkChunkIntegrity(integrityCursor);
+
+		integrityCursor = integrityCursor->next;
+
+		if (!(++n % INTEGRITY_SLICE_CHUNKS) && (now_us = integrity_time_us()) >= start_us + budget_us)
+			break;
 	}
 
+	if (n % INTEGRITY_SLICE_CHUNKS)
+		now_us = integrity_time_us();
+
+	integrity_stats.chunks += n;
+	integrity_stats.slices++;
+	integrity_stats.sliceMaxUs = XMAX(integrity_stats.sliceMaxUs, (uint32_t) (now_us - start_us));
+
+	if (!integrityCursor) {
+		integrity_stats.cycles++;
+		integrity_stats.lastChunks = integrity_stats.chunks;
+		integrity_stats.lastSlices = integrity_stats.slices;
+		integrity_stats.lastDuration = bmx_time - integrityCycleStart;
+		integrity_stats.chunks = 0;
+		integrity_stats.slices = 0;
+	}
+}
+
+struct integrity_status {
+        uint32_t cycles;
+        uint32_t cyclePeriod;
+        uint32_t cycleDuration;
+        uint32_t cycleChunks;
+        uint32_t cycleSlices;
+        uint32_t sliceMaxUs;
+};
+
+static const struct field_format integrity_status_format[] = {
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              integrity_status, cycles,        1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              integrity_status, cyclePeriod,   1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              integrity_status, cycleDuration, 1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              integrity_status, cycleChunks,   1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              integrity_status, cycleSlices,   1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              integrity_status, sliceMaxUs,    1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_END
+};
+
+STATIC_FUNC
+int32_t integrity_status_creator(struct status_handl *handl, void *data)
+{
+        struct integrity_status *status = (struct integrity_status *) (handl->data =
+                debugRealloc(handl->data, sizeof (struct integrity_status), -300595));
+
+        status->cycles = integrity_stats.cycles;
+        status->cyclePeriod = integrity_stats.lastPeriod;
+        status->cycleDuration = integrity_stats.lastDuration;
+        status->cycleChunks = integrity_stats.lastChunks;
+        status->cycleSlices = integrity_stats.lastSlices;
+        status->sliceMaxUs = integrity_stats.sliceMaxUs;
+
+        return sizeof (struct integrity_status);
+}
+
+void init_integrity_check(void)
+{
+        register_status_handl(sizeof (struct integrity_status), 0, integrity_status_format, ARG_INTEGRITY, integrity_status_creator);
 }
 
 void checkLeak(void)
@@ -200,12 +569,10 @@ void *_debugMalloc(uint32_t length, int32_t tag, uint8_t reset)
         if (!length)
                 return NULL;
 
-	if (reset) {
-		memory = malloc(length + sizeof(struct chunkHeader) + sizeof(MAGIC_TRAILER_T));
+	memory = pool_alloc(length + sizeof(struct chunkHeader) + sizeof(MAGIC_TRAILER_T));
+
+	if (memory && reset)
 		memset(memory, 0, length + sizeof(struct chunkHeader) + sizeof(MAGIC_TRAILER_T));
-	} else {
-		memory = malloc(length + sizeof(struct chunkHeader) + sizeof(MAGIC_TRAILER_T));
-	}
 
 	if (memory == NULL)
 	{
@@ -225,6 +592,11 @@ void *_debugMalloc(uint32_t length, int32_t tag, uint8_t reset)
 	*chunkTrailer = MAGIC_NUMBER_TRAILOR;
 
 	chunkHeader->next = chunkList;
+	chunkHeader->prev = NULL;
+
+	if (chunkList)
+		chunkList->prev = chunkHeader;
+
 	chunkList = chunkHeader;
 
 #ifdef MEMORY_USAGE
@@ -277,11 +649,16 @@ void *_debugRealloc(void *memoryParameter, uint32_t length, int32_t tag)
 void _debugFree(void *memoryParameter, int tag)
 {
 	MAGIC_TRAILER_T *chunkTrailer;
-	struct chunkHeader *walker;
-	struct chunkHeader *previous;
 	struct chunkHeader *chunkHeader =
 		(struct chunkHeader *) (((unsigned char *) memoryParameter) - sizeof (struct chunkHeader));
 
+        if (chunkHeader->magicNumberHeader == MAGIC_NUMBER_FREED)
+	{
+		dbg_sys(DBGT_ERR, "Double free detected, malloc tag = %d, free tag = %d malloc size = %d",
+		     chunkHeader->tag, tag, chunkHeader->length );
+		cleanup_all( -500081 );
+	}
+
         if (chunkHeader->magicNumberHeader != MAGIC_NUMBER_HEADER)
 	{
 		dbgf_sys(DBGT_ERR,
@@ -290,30 +667,14 @@ void _debugFree(void *memoryParameter, int tag)
 		cleanup_all( -500080 );
 	}
 
-	previous = NULL;
-
-	for (walker = chunkList; walker != NULL; walker = walker->next)
-	{
-		if (walker == chunkHeader)
-			break;
-
-		previous = walker;
-	}
-
-	if (walker == NULL)
+	if ((chunkHeader->prev ? chunkHeader->prev->next : chunkList) != chunkHeader ||
+		(chunkHeader->next && chunkHeader->next->prev != chunkHeader))
 	{
-		dbg_sys(DBGT_ERR, "Double free detected, malloc tag = %d, free tag = %d malloc size = %d",
+		dbg_sys(DBGT_ERR, "Freeing unlisted chunk (double free or corruption), malloc tag = %d, free tag = %d malloc size = %d",
 		     chunkHeader->tag, tag, chunkHeader->length );
-		cleanup_all( -500081 );
+		cleanup_all( -501588 );
 	}
 
-	if (previous == NULL)
-		chunkList = walker->next;
-
-	else
-		previous->next = walker->next;
-
-
         chunkTrailer = (MAGIC_TRAILER_T *) (((unsigned char *) memoryParameter) + chunkHeader->length);
 
 	if (*chunkTrailer != MAGIC_NUMBER_TRAILOR) {
@@ -322,19 +683,261 @@ void _debugFree(void *memoryParameter, int tag)
 		cleanup_all( -500082 );
 	}
 
+	if (integrityCursor == chunkHeader)
+		integrityCursor = chunkHeader->next;
+
+	if (chunkHeader->prev)
+		chunkHeader->prev->next = chunkHeader->next;
+	else
+		chunkList = chunkHeader->next;
+
+	if (chunkHeader->next)
+		chunkHeader->next->prev = chunkHeader->prev;
+
+	chunkHeader->magicNumberHeader = MAGIC_NUMBER_FREED;
+
 #ifdef MEMORY_USAGE
 
-	removeMemory( chunkHeader->tag, tag );
+	removeMemory( chunkHeader->length, chunkHeader->tag, tag );
 
 #endif //#ifdef MEMORY_USAGE
 
 	if (!terminating)
-		free(chunkHeader);
+		pool_free(chunkHeader, chunkHeader->length + sizeof(struct chunkHeader) + sizeof(MAGIC_TRAILER_T));
 
 
 }
 
 
+#ifdef MALLOC_TEST
+
+/*
+ * Compares _debugFree() against the former chunkList walk with n live chunks freed in random order.
+ * The walk variant searches each chunk from the list head (as the former singly-linked list required)
+ * before unlinking it.
+ */
+STATIC_FUNC
+uint32_t malloc_bench_usec(struct timeval *start)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &diff);
+	gettimeofday(start, NULL);
+
+	return (diff.tv_sec * 1000000) + diff.tv_usec;
+}
+
+STATIC_FUNC
+void malloc_bench_free_walk(void *mem, int32_t tag)
+{
+	struct chunkHeader *walker;
+	struct chunkHeader *chunkHeader = (struct chunkHeader *) (((unsigned char *) mem) - sizeof (struct chunkHeader));
+
+	for (walker = chunkList; walker && walker != chunkHeader; walker = walker->next);
+
+	assertion(-501589, (walker));
+
+	_debugFree(mem, tag);
+}
+
+void debugMallocBench(int32_t n)
+{
+	void **chunks = malloc(n * sizeof (void*));
+	uint32_t *order = malloc(n * sizeof (uint32_t));
+	uint32_t alloc_us, walk_us, free_us;
+	struct timeval start;
+	int32_t i;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+
+	for (i = n - 1; i > 0; i--) {
+		uint32_t r = rand_num(i + 1), t = order[i];
+		order[i] = order[r];
+		order[r] = t;
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < n; i++)
+		chunks[i] = debugMalloc(16 + (i % 64), -300592);
+
+	alloc_us = malloc_bench_usec(&start);
+
+	for (i = 0; i < n; i++)
+		malloc_bench_free_walk(chunks[order[i]], -300593);
+
+	walk_us = malloc_bench_usec(&start);
+
+	for (i = 0; i < n; i++)
+		chunks[i] = debugMalloc(16 + (i % 64), -300592);
+
+	malloc_bench_usec(&start);
+
+	for (i = 0; i < n; i++)
+		debugFree(chunks[order[i]], -300593);
+
+	free_us = malloc_bench_usec(&start);
+
+	printf("chunks=%d               malloc         free (usec)\n", n);
+	printf("doubly-linked:      %10u   %10u\n", alloc_us, free_us);
+	printf("chunkList walk:     %10u   %10u\n", alloc_us, walk_us);
+	printf("speedup:                         %10.1f\n", (double) walk_us / XMAX(free_us, 1));
+
+	free(chunks);
+	free(order);
+}
+
+/*
+ * Synthetic churn of n live objects with sizes of hot routing objects (mostly avl, task, and router nodes,
+ * some message arrays), each round replacing a random object with a new one of random size.
+ * Both variants run with the same random sequence in a forked child so their heaps do not interfere.
+ */
+STATIC_FUNC
+uint32_t malloc_churn_rss_kb(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	unsigned long size = 0, resident = 0;
+
+	if (f) {
+		if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+STATIC_FUNC
+uint32_t malloc_churn_size(void)
+{
+	static const uint32_t hot_sizes[] = {
+		sizeof (struct avl_node), sizeof (struct avl_node), sizeof (struct avl_node),
+		sizeof (struct task_node), sizeof (struct task_node),
+		sizeof (struct tx_task_node), sizeof (struct router_node), sizeof (struct ogm_aggreg_node)
+	};
+
+	// 80% hot nodes, 20% message arrays:
+	uint32_t size = rand_num(10) < 8 ?
+		hot_sizes[rand_num(sizeof (hot_sizes) / sizeof (hot_sizes[0]))] : (64 + rand_num(960));
+
+	return size + sizeof (struct chunkHeader) + sizeof (MAGIC_TRAILER_T);
+}
+
+STATIC_FUNC
+void malloc_churn_run(int32_t n, int32_t rounds, IDM_T pools, char *name)
+{
+	void **slots = malloc(n * sizeof (void*));
+	uint32_t *sizes = malloc(n * sizeof (uint32_t));
+	uint32_t rss_start = malloc_churn_rss_kb(), rss_filled, churn_us;
+	struct timeval start;
+	int32_t i;
+
+	srand(1);
+
+	for (i = 0; i < n; i++) {
+		sizes[i] = malloc_churn_size();
+		slots[i] = pools ? pool_alloc(sizes[i]) : malloc(sizes[i]);
+		memset(slots[i], 0, sizes[i]);
+	}
+
+	rss_filled = malloc_churn_rss_kb();
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < rounds; i++) {
+		uint32_t r = rand_num(n);
+
+		if (pools)
+			pool_free(slots[r], sizes[r]);
+		else
+			free(slots[r]);
+
+		sizes[r] = malloc_churn_size();
+		slots[r] = pools ? pool_alloc(sizes[r]) : malloc(sizes[r]);
+		*((uint32_t*) slots[r]) = i;
+	}
+
+	churn_us = malloc_bench_usec(&start);
+
+	printf("%-12s %14.0f %16u %16u\n", name, ((double) rounds * 1000000) / XMAX(churn_us, 1),
+		rss_filled - rss_start, malloc_churn_rss_kb() - rss_start);
+	fflush(stdout);
+}
+
+void debugMallocChurn(int32_t n)
+{
+	IDM_T pools;
+
+	printf("live=%d rounds=%d  alloc+free/sec  RSS filled (kB)  RSS churned (kB)\n", n, 20 * n);
+	fflush(stdout);
+
+	// without MEMORY_POOLS, pool_alloc() is just malloc():
+#ifdef MEMORY_POOLS
+	for (pools = NO; pools <= YES; pools++) {
+#else
+	for (pools = NO; pools <= NO; pools++) {
+#endif
+
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			malloc_churn_run(n, 20 * n, pools, pools ? "slab pools:" : "malloc():");
+			_exit(EXIT_SUCCESS);
+		} else if (pid > 0) {
+			waitpid(pid, NULL, 0);
+		}
+	}
+}
+
+#endif
+
+
+#else
+
+#ifdef MEMORY_POOLS
+
+// the pools need the size of a freed object, so it is kept in front of it:
+#define POOL_PREFIX_SIZE 8
+
+void * _malloc( size_t length ) {
+	uint8_t *mem = pool_alloc( length + POOL_PREFIX_SIZE );
+
+	if ( !mem )
+		return NULL;
+
+	*((uint32_t*) mem) = length;
+	return mem + POOL_PREFIX_SIZE;
+}
+
+void * _calloc( size_t length ) {
+	void *mem = _malloc( length );
+	memset( mem, 0, length);
+	return mem;
+}
+
+void * _realloc( void *mem, size_t length ) {
+
+	void *result = _malloc( length );
+
+	if ( mem ) {
+		size_t old_length = *((uint32_t*) (((uint8_t*) mem) - POOL_PREFIX_SIZE));
+		memcpy( result, mem, old_length < length ? old_length : length );
+		_free( mem );
+	}
+
+	return result;
+}
+
+void _free( void *mem ) {
+
+	if (!terminating && mem) {
+		uint8_t *prefix = ((uint8_t*) mem) - POOL_PREFIX_SIZE;
+		pool_free( prefix, *((uint32_t*) prefix) + POOL_PREFIX_SIZE );
+	}
+}
+
 #else
 
 void * _malloc( size_t length ) {
@@ -356,5 +959,6 @@ void _free( void *mem ) {
 		free( mem );
 }
 
+#endif
 
 #endif
\ No newline at end of file
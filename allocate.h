@@ -23,9 +23,14 @@
 
 #include <stdint.h>
 
+#define POOL_SLAB_SIZE 16384
+#define POOL_CLASS_STEP 16
+#define POOL_CLASS_MAX 512
+#define POOL_CLASSES (POOL_CLASS_MAX / POOL_CLASS_STEP)
+
 #ifdef DEBUG_MALLOC
 
-// currently used memory tags: -300000, -300001 .. -300562
+// currently used memory tags: -300000, -300001 .. -300617
 #define debugMalloc( length,tag )  _debugMalloc( (length), (tag), 0 )
 #define debugMallocReset( length,tag )  _debugMalloc( (length), (tag), 1 )
 #define debugRealloc( mem,length,tag ) _debugRealloc( (mem), (length), (tag) )
@@ -37,9 +42,29 @@ void *_debugRealloc(void *memory, uint32_t length, int32_t tag);
 void _debugFree(void *memoryParameter, int32_t tag);
 
 void checkIntegrity(void);
+void checkIntegritySlice(uint32_t budget_us);
+void init_integrity_check(void);
 void checkLeak(void);
+
+#define INTEGRITY_SLICE_CHUNKS 64    // chunks checked between two looks at the clock
+#define INTEGRITY_CYCLE_MIN_MS 1000  // minimum period between the start of two full heap cycles
 void debugMemory( struct ctrl_node *cn );
 
+#ifdef MEMORY_USAGE
+#define MEMORY_TAG_BASE -300000
+#define MEMORY_TAGS_DIRECT 1024 // tags -300000 .. -301023
+#define MEMORY_TAGS_HASHED 256  // any other tags
+
+void init_memory_usage(void);
+#else
+#define init_memory_usage()
+#endif
+
+#ifdef MALLOC_TEST
+void debugMallocBench(int32_t n);
+void debugMallocChurn(int32_t n);
+#endif
+
 #else
 
 #define debugMalloc( length,tag )  _malloc( (length) )
@@ -47,9 +72,12 @@ void debugMemory( struct ctrl_node *cn );
 #define debugRealloc( mem,length,tag ) _realloc( (mem), (length) )
 #define debugFree( mem,tag ) _free( (mem) )
 
-#define checkIntegrity()
+#define checkIntegrity() do { } while (0)
+#define checkIntegritySlice( budget ) do { } while (0)
+#define init_integrity_check()
 #define checkLeak()
 #define debugMemory( c )
+#define init_memory_usage()
 
 void * _malloc( size_t length );
 void * _calloc( size_t length );
@@ -24,19 +24,67 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <endian.h>
 
 #include "bmx.h"
 #include "avl.h"
+#include "hash.h"
+#include "tools.h"
 
 #define CODE_CATEGORY_NAME "avl"
 
+
+/*
+ * Inline key comparison in memcmp() order: keys are loaded as big-endian words, so e.g. a 4-byte local_id
+ * or a 20-byte SHA1 hash costs one, or three, word compares instead of a memcmp() call.
+ */
+#define AVL_CMP_WORD(bits, a, b, offset) do { \
+        uint##bits##_t x, y; \
+        memcpy(&x, ((const uint8_t*) (a)) + (offset), sizeof (x)); \
+        memcpy(&y, ((const uint8_t*) (b)) + (offset), sizeof (y)); \
+        if (x != y) \
+                return be##bits##toh(x) > be##bits##toh(y) ? 1 : -1; \
+} while (0)
+
+#define AVL_CMP_FUNC(bytes, ...) \
+STATIC_INLINE_FUNC int avl_cmp_##bytes(const void *a, const void *b) { __VA_ARGS__; return 0; }
+
+AVL_CMP_FUNC(1,  if (*((const uint8_t*) a) != *((const uint8_t*) b)) return *((const uint8_t*) a) > *((const uint8_t*) b) ? 1 : -1)
+AVL_CMP_FUNC(2,  AVL_CMP_WORD(16, a, b, 0))
+AVL_CMP_FUNC(4,  AVL_CMP_WORD(32, a, b, 0))
+AVL_CMP_FUNC(8,  AVL_CMP_WORD(64, a, b, 0))
+AVL_CMP_FUNC(16, AVL_CMP_WORD(64, a, b, 0); AVL_CMP_WORD(64, a, b, 8))
+AVL_CMP_FUNC(20, AVL_CMP_WORD(64, a, b, 0); AVL_CMP_WORD(64, a, b, 8); AVL_CMP_WORD(32, a, b, 16))
+
+STATIC_INLINE_FUNC
+int avl_cmp(struct avl_tree *tree, const void *a, const void *b)
+{
+        if (tree->cmp)
+                return (*(tree->cmp)) (a, b, tree->key_size);
+
+        switch (tree->key_size) {
+        case 1: return avl_cmp_1(a, b);
+        case 2: return avl_cmp_2(a, b);
+        case 4: return avl_cmp_4(a, b);
+        case 8: return avl_cmp_8(a, b);
+        case 16: return avl_cmp_16(a, b);
+        case 20: return avl_cmp_20(a, b);
+        default: return memcmp(a, b, tree->key_size);
+        }
+}
+
 struct avl_node *avl_find( struct avl_tree *tree, void *key )
 {
+        if (tree->hash && tree->intrusive) {
+                void *item = hash_find(tree->hash, key);
+                return item ? AVL_ITEM_NODE(tree, item) : NULL;
+        }
+
         struct avl_node *an = tree->root;
         int cmp;
 
         // Search for a dead path or a matching entry
-        while ( an  &&  ( cmp = memcmp( AVL_NODE_KEY( tree, an ), key, tree->key_size) ) )
+        while ( an  &&  ( cmp = avl_cmp( tree, AVL_NODE_KEY( tree, an ), key ) ) )
                 an = an->down[ cmp < 0 ];
 
         return an;
@@ -44,6 +92,9 @@ struct avl_node *avl_find( struct avl_tree *tree, void *key )
 
 void *avl_find_item(struct avl_tree *tree, void *key)
 {
+        if (tree->hash)
+                return hash_find(tree->hash, key);
+
         struct avl_node *an;
 
         return ((an = avl_find(tree, key)) ? an->item : NULL);
@@ -77,7 +128,7 @@ struct avl_node *avl_next(struct avl_tree *tree, void *key)
 
         while (an) {
 
-                cmp = (memcmp(AVL_NODE_KEY(tree, an), key, tree->key_size) <= 0);
+                cmp = (avl_cmp(tree, AVL_NODE_KEY(tree, an), key) <= 0);
 
                 if (an->down[cmp]) {
                         best = cmp ? best : an;
@@ -168,24 +219,108 @@ void *avl_iterate_item(struct avl_tree *tree, struct avl_node **an )
 #endif
 }
 
-void *_avl_find_item_by_field(struct avl_tree *tree, void *value, unsigned long offset, uint32_t size)
+static struct avl_index *avl_indexes; // all added secondary indexes
+
+STATIC_FUNC
+void avl_index_insert_item(struct avl_index *index, void *item)
 {
-        struct avl_node *an = NULL;
-        void *item = NULL;
+        if (!index->hash)
+                index->hash = hash_create(index->key_size, index->key_offset, HASH_KEY_MIXED | HASH_KEY_DUPLICATES);
 
-        while ((item = avl_iterate_item(tree, &an))) {
-                if (!memcmp(value, (((char*)(an->item)) + offset), size))
-                        break;
+        hash_insert(index->hash, item);
+}
+
+STATIC_FUNC
+void avl_index_remove_item(struct avl_index *index, void *item)
+{
+        hash_remove(index->hash, item);
+
+        if (!index->hash->items) {
+                hash_destroy(index->hash);
+                index->hash = NULL;
         }
+}
+
+STATIC_FUNC
+void avl_index_check_one(struct avl_index *index)
+{
+        struct avl_tree *tree = index->tree;
+        struct avl_node *an = NULL;
+        void *item;
+
+        assertion_dbg(-501620, (tree->items ? (index->hash && index->hash->items == tree->items) : !index->hash),
+                "items=%d indexed=%d", tree->items, index->hash ? index->hash->items : 0);
+
+        while ((item = avl_iterate_item(tree, &an)))
+                assertion_dbg(-501621, (hash_has_item(index->hash, item)), "item=%p missing or re-keyed while linked", item);
+}
+
+// compares every secondary index against a full scan of its tree
+void avl_index_check(void)
+{
+        struct avl_index *index;
+
+        for (index = avl_indexes; index; index = index->all)
+                avl_index_check_one(index);
+}
+
+/*
+ * Adds a secondary index to a tree and indexes the items it already has.
+ */
+void avl_index_add(struct avl_tree *tree, struct avl_index *index)
+{
+        struct avl_node *an = NULL;
+        void *item;
+
+        assertion(-501619, (!index->tree && !index->hash && index->key_size));
 
-        return item;
+        index->tree = tree;
+        index->next = tree->indexes;
+        tree->indexes = index;
+        index->all = avl_indexes;
+        avl_indexes = index;
+
+        while ((item = avl_iterate_item(tree, &an)))
+                avl_index_insert_item(index, item);
+}
+
+// returns any item of the indexed tree whose indexed field equals value
+void *avl_index_find_item(struct avl_index *index, void *value)
+{
+#ifdef EXTREME_PARANOIA
+        avl_index_check_one(index);
+#endif
+        return index->hash ? hash_find(index->hash, value) : NULL;
+}
+
+void avl_index_unlink(struct avl_tree *tree, void *item)
+{
+        struct avl_index *index;
+
+        for (index = tree->indexes; index; index = index->next)
+                avl_index_remove_item(index, item);
+}
+
+void avl_index_link(struct avl_tree *tree, void *item)
+{
+        struct avl_index *index;
+
+        for (index = tree->indexes; index; index = index->next)
+                avl_index_insert_item(index, item);
 }
 
 
 STATIC_FUNC
 struct avl_node *avl_create_node(struct avl_tree *tree, void *node, int32_t tag, struct avl_node *up, struct avl_node *left, struct avl_node *right)
 {
-        struct avl_node *an = debugMallocReset(sizeof (struct avl_node), tag);
+        struct avl_node *an;
+
+        if (tree->intrusive) {
+                an = AVL_ITEM_NODE(tree, node);
+                memset(an, 0, sizeof (struct avl_node));
+        } else {
+                an = debugMallocReset(sizeof (struct avl_node), tag);
+        }
 
         an->item = node;
 	an->up = up;
@@ -212,6 +347,15 @@ struct avl_node *avl_create_node(struct avl_tree *tree, void *node, int32_t tag,
 	return an;
 }
 
+STATIC_FUNC
+void avl_free_node(struct avl_tree *tree, struct avl_node *an, int32_t tag)
+{
+        if (tree->intrusive)
+                memset(an, 0, sizeof (struct avl_node));
+        else
+                debugFree(an, tag);
+}
+
 STATIC_FUNC
 struct avl_node *avl_rotate_single(struct avl_node *root, int dir)
 {
@@ -275,7 +419,7 @@ void avl_insert(struct avl_tree *tree, void *node, int32_t tag)
                 // Search for an empty link, save the path
                 for (;;) {
                         // Push direction and node onto stack */
-			ngi = (memcmp(AVL_NODE_KEY(tree, it), AVL_ITEM_KEY(tree, node), tree->key_size) <= 0);
+			ngi = (avl_cmp(tree, AVL_NODE_KEY(tree, it), AVL_ITEM_KEY(tree, node)) <= 0);
 #ifdef AVL_5XLINKED
 			if (ngi)
 				left = it;
@@ -348,14 +492,47 @@ void avl_insert(struct avl_tree *tree, void *node, int32_t tag)
 
 	assertion(-500000, (new));
 #ifdef AVL_5XLINKED
-	assertion(-500000, ( new->left  || avl_first(tree)==new));
-	assertion(-500000, (!new->left  || avl_next(tree, AVL_ITEM_KEY(tree, new->left->item))==new));
-	assertion(-500000, (!new->right || avl_next(tree, AVL_ITEM_KEY(tree, new->item))==new->right));
+	assertion(-501592, (new->left ? (new->left->right == new &&
+		avl_cmp(tree, AVL_NODE_KEY(tree, new->left), AVL_NODE_KEY(tree, new)) <= 0) : tree->first == new));
+	assertion(-501593, (new->right ? (new->right->left == new &&
+		avl_cmp(tree, AVL_NODE_KEY(tree, new), AVL_NODE_KEY(tree, new->right)) < 0) : tree->last == new));
 #endif
+        if (tree->hashed) {
+
+                if (!tree->hash)
+                        tree->hash = hash_create(tree->key_size, tree->key_offset, tree->hashed);
+
+                hash_insert(tree->hash, node);
+        }
+
+        avl_index_link(tree, node);
+
 	ASSERTION(-500000, avl_find_item(tree, AVL_ITEM_KEY(tree, node)));
         return;
 }
 
+/*
+ * Adds an exact-match hash index to a tree with unique keys. Ordered functions keep using the tree.
+ * The index is created with the first item and freed with the last one.
+ */
+void avl_hash_index(struct avl_tree *tree, uint8_t hash_key)
+{
+        struct avl_node *an = NULL;
+        void *item;
+
+        assertion(-501613, (!tree->hashed && hash_key != HASH_KEY_NONE));
+
+        tree->hashed = hash_key;
+
+        while ((item = avl_iterate_item(tree, &an))) {
+
+                if (!tree->hash)
+                        tree->hash = hash_create(tree->key_size, tree->key_offset, tree->hashed);
+
+                hash_insert(tree->hash, item);
+        }
+}
+
 
 
 void *avl_remove(struct avl_tree *tree, void *key, int32_t tag)
@@ -372,17 +549,17 @@ void *avl_remove(struct avl_tree *tree, void *key, int32_t tag)
 
         while (1) {
 
-                dbgf_all(DBGT_INFO, "tree.items=%d it->item=%p memcmp(it,key)=%d link[0]=%p link[1]=%p memcmp(link[0],key)=%d memcmp(link[1],key)=%d",
+                dbgf_all(DBGT_INFO, "tree.items=%d it->item=%p cmp(it,key)=%d link[0]=%p link[1]=%p cmp(link[0],key)=%d cmp(link[1],key)=%d",
                         tree->items, it->item,
-                        memcmp(AVL_NODE_KEY(tree, it), key, tree->key_size),
+                        avl_cmp(tree, AVL_NODE_KEY(tree, it), key),
                         (void*) (it->down[0]), (void*) (it->down[1]),
-                        (it->down[0] ? memcmp(AVL_NODE_KEY(tree, it->down[0]), key, tree->key_size) : -1),
-                        (it->down[1] ? memcmp(AVL_NODE_KEY(tree, it->down[1]), key, tree->key_size) : -1)
+                        (it->down[0] ? avl_cmp(tree, AVL_NODE_KEY(tree, it->down[0]), key) : -1),
+                        (it->down[1] ? avl_cmp(tree, AVL_NODE_KEY(tree, it->down[1]), key) : -1)
                         );
 
                 if (!(
-                        (cmp = memcmp(AVL_NODE_KEY(tree, it), key, tree->key_size)) ||
-                        (it->down[0] && !memcmp(AVL_NODE_KEY(tree, it->down[0]), key, tree->key_size))))
+                        (cmp = avl_cmp(tree, AVL_NODE_KEY(tree, it), key)) ||
+                        (it->down[0] && !avl_cmp(tree, AVL_NODE_KEY(tree, it->down[0]), key))))
                         break;
 
                 // Push direction and node onto stack
@@ -433,7 +610,7 @@ void *avl_remove(struct avl_tree *tree, void *key, int32_t tag)
                                 tree->root->up = NULL;
                 }
 
-                debugFree(it, tag);
+                avl_free_node(tree, it, tag);
 
         } else { // both childs NOT NULL:
 
@@ -441,6 +618,7 @@ void *avl_remove(struct avl_tree *tree, void *key, int32_t tag)
                 struct avl_node *heir = it->down[1];
 
                 // Save the path
+                int itop = top;
                 upd[top] = 1;
                 up[top] = it;
                 top++;
@@ -452,45 +630,49 @@ void *avl_remove(struct avl_tree *tree, void *key, int32_t tag)
                         heir = heir->down[0];
                 }
 
-                // Swap data
-                it->item = heir->item;
-
                 // Unlink successor and fix parent
                 up[top - 1]->down[ (up[top - 1] == it) ] = heir->down[1];
 
                 if ( heir->down[1])
                         heir->down[1]->up = up[top - 1];
 
-#ifdef AVL_5XLINKED
-		// fix left/right caches:
-		if (left==heir)
-			left=it;
-		if (right==heir)
-			right=it;
+                // Move the successor node into the place of the removed one. Nodes keep their items
+                // because intrusive nodes can not be passed to another item:
+                heir->down[0] = it->down[0];
+                heir->down[1] = it->down[1];
+                heir->balance = it->balance;
+                heir->up = it->up;
+
+                if (heir->down[0])
+                        heir->down[0]->up = heir;
+
+                if (heir->down[1])
+                        heir->down[1]->up = heir;
 
-		// fix left,right,first,last:
+                if (itop)
+                        up[itop - 1]->down[upd[itop - 1]] = heir;
+                else
+                        tree->root = heir;
 
-		if (tree->first == heir)
-			tree->first = it;
+                up[itop] = heir;
 
-		if (tree->last == heir)
-			tree->last = it;
+                avl_free_node(tree, it, tag);
 
-		it->left = heir->left;
+        }
 
-		if (heir->left)
-			heir->left->right = it;
+        tree->items--;
 
-		it->right = heir->right;
+        if (tree->hash) {
 
-		if (heir->right)
-			heir->right->left = it;
-#endif
-                debugFree(heir, tag);
+                hash_remove(tree->hash, node);
 
+                if (!tree->items) {
+                        hash_destroy(tree->hash);
+                        tree->hash = NULL;
+                }
         }
 
-        tree->items--;
+        avl_index_unlink(tree, node);
 
         // Walk back up the search path
         while (--top >= 0) {
@@ -538,13 +720,9 @@ void *avl_remove(struct avl_tree *tree, void *key, int32_t tag)
         }
 
 #ifdef AVL_5XLINKED
-	assertion(-500000, (!left  ||   left->left   || avl_first(tree)==left));
-	assertion(-500000, (!left  ||  !left->left   || avl_next(tree, AVL_ITEM_KEY(tree, left->left->item))==left));
-	assertion(-500000, (!left  ||  !left->right  || avl_next(tree, AVL_ITEM_KEY(tree, left->item))==left->right));
-
-	assertion(-500000, (!right ||  right->left   || avl_first(tree)==right));
-	assertion(-500000, (!right || !right->left   || avl_next(tree, AVL_ITEM_KEY(tree, right->left->item))==right));
-	assertion(-500000, (!right || !right->right  || avl_next(tree, AVL_ITEM_KEY(tree, right->item))==right->right));
+	// the former neighbours must now be linked with each other:
+	assertion(-501594, (left ? left->right == right : tree->first == right));
+	assertion(-501595, (right ? right->left == left : tree->last == left));
 #endif
         return node;
 
@@ -575,7 +753,7 @@ struct avl_node *_avl_iter_down(int dir, struct avl_node *an, struct avl_iterato
                 it->up[it->top] = an;
                 it->upd[it->top] = dir;
 
-                an = an->link[dir];
+                an = an->down[dir];
         }
         it->top--;
         return it->up[it->top];
@@ -594,7 +772,7 @@ struct avl_node *avl_iter(struct avl_tree *tree, struct avl_iterator *it ) {
                 return _avl_iter_down( 0/*left*/, an, it );
         }
 
-        if ((an = it->up[(it->top)]->link[1])) {
+        if ((an = it->up[(it->top)]->down[1])) {
                 //go one right, then left...
                 it->upd[it->top] = 1;
                 it->top++;
@@ -625,7 +803,7 @@ void avl_debug( struct avl_tree *tree ) {
         int depth_min = 0;
 
         struct avl_node *an;
-        for (an = tree->root; an; an = an->link[0])
+        for (an = tree->root; an; an = an->down[0])
                 depth_min++;
 
         int depth_max = depth_min+2;
@@ -730,11 +908,10 @@ void avl_test( int max ) {
 
         // debug test_tree:
 
-        printf("\navl_iterate( test_tree ):\n");
+        printf("\navl_iterate_item( test_tree ):\n");
         i=0;
         an = NULL;
-        while( (an = avl_iterate( &test_tree, an ) ) ) {
-                t = ((struct test_type*)(an->item));
+        while( (t = avl_iterate_item( &test_tree, &an ) ) ) {
                 if ( i > t->test_key)
                         printf("\nERROR %d > %d \n", i, t->test_key);
                 i = t->test_key;
@@ -770,11 +947,10 @@ void avl_test( int max ) {
 
         // debug test_tree2:
 
-        printf("\navl_iterate( test_tree2 ):\n");
+        printf("\navl_iterate_item( test_tree2 ):\n");
         i=0;
         an = NULL;
-        while( (an = avl_iterate( &test_tree2, an ) ) ) {
-                t = ((struct test_type*)(an->item));
+        while( (t = avl_iterate_item( &test_tree2, &an ) ) ) {
                 if ( i > t->test_key2)
                         printf("\nERROR %d > %d \n", i, t->test_key2);
                 i = t->test_key2;
@@ -821,11 +997,531 @@ void avl_test( int max ) {
 }
 
 
+/*
+ * Verifies the complete structure of a tree: up links, heights and balance, in-order key order,
+ * item count, and (with AVL_5XLINKED) that first/last and the left/right thread match the in-order walk.
+ */
+STATIC_FUNC
+int avl_check_subtree(struct avl_tree *tree, struct avl_node *an, struct avl_node *up, struct avl_node **prev, uint32_t *items)
+{
+        if (!an)
+                return -1;
+
+        assertion_dbg(-501596, (an->up == up), "node=%p up=%p expected=%p", (void*) an, (void*) an->up, (void*) up);
+
+        int lh = avl_check_subtree(tree, an->down[0], an, prev, items);
+
+        // compare with memcmp() (or the tree's own comparator), independently of the inline comparators:
+        assertion_dbg(-501597, (!(*prev) || (tree->cmp ? (*(tree->cmp)) (AVL_NODE_KEY(tree, *prev), AVL_NODE_KEY(tree, an), tree->key_size) :
+                memcmp(AVL_NODE_KEY(tree, *prev), AVL_NODE_KEY(tree, an), tree->key_size)) <= 0),
+                "node=%p out of order", (void*) an);
+#ifdef AVL_5XLINKED
+        assertion_dbg(-501598, (an->left == (*prev) && ((*prev) ? (*prev)->right == an : tree->first == an)),
+                "node=%p left=%p prev=%p", (void*) an, (void*) an->left, (void*) (*prev));
+#endif
+        (*prev) = an;
+        (*items)++;
+
+        int rh = avl_check_subtree(tree, an->down[1], an, prev, items);
+
+        assertion_dbg(-501599, (an->balance == avl_max(lh, rh) + 1 && lh - rh <= 1 && rh - lh <= 1),
+                "node=%p balance=%d lh=%d rh=%d", (void*) an, an->balance, lh, rh);
+
+        return an->balance;
+}
+
+STATIC_FUNC
+void avl_check(struct avl_tree *tree)
+{
+        struct avl_node *prev = NULL;
+        uint32_t items = 0;
+
+        avl_check_subtree(tree, tree->root, NULL, &prev, &items);
+
+        assertion_dbg(-501600, (items == tree->items), "items=%d counted=%d", tree->items, items);
+#ifdef AVL_5XLINKED
+        assertion_dbg(-501601, (tree->last == prev && (!prev || !prev->right)), "last=%p expected=%p", (void*) tree->last, (void*) prev);
+#endif
+}
+
+/*
+ * Random inserts and removes with duplicate keys against a per-key reference count, checking the whole
+ * tree after every operation. Key ranges of 16, 256, and 4096 exercise small trees and deep rebalancing.
+ */
+STATIC_FUNC
+void avl_fuzz(int32_t ops)
+{
+        struct fuzz_type {
+                uint16_t key;
+                uint16_t id;
+        };
+
+        AVL_TREE(fuzz_tree, struct fuzz_type, key);
+        uint32_t ranges[] = {16, 256, 4096};
+        uint32_t r, i, inserts = 0, removes = 0;
+
+        srand(ops);
+
+        for (r = 0; r < sizeof (ranges) / sizeof (ranges[0]); r++) {
+
+                uint32_t *counts = debugMallocReset(ranges[r] * sizeof (uint32_t), -300596);
+                struct fuzz_type *t;
+
+                for (i = 0; i < (uint32_t) ops; i++) {
+
+                        uint16_t key = rand_num(ranges[r]);
+
+                        if (rand_num(100) < (fuzz_tree.items < ranges[r] / 2 ? 60 : 40)) {
+
+                                t = debugMalloc(sizeof (struct fuzz_type), -300004);
+                                t->key = key;
+                                t->id = i;
+                                avl_insert(&fuzz_tree, t, -300300);
+                                counts[key]++;
+                                inserts++;
+
+                        } else {
+
+                                t = avl_remove(&fuzz_tree, &key, -300190);
+
+                                assertion_dbg(-501602, (counts[key] ? (t && t->key == key) : !t),
+                                        "key=%d count=%d removed=%p", key, counts[key], (void*) t);
+
+                                if (t) {
+                                        counts[key]--;
+                                        removes++;
+                                        debugFree(t, -300042);
+                                }
+                        }
+
+                        avl_check(&fuzz_tree);
+                }
+
+                while ((t = avl_remove_first_item(&fuzz_tree, -300190))) {
+                        counts[t->key]--;
+                        debugFree(t, -300042);
+                        avl_check(&fuzz_tree);
+                }
+
+                for (i = 0; i < ranges[r]; i++)
+                        assertion(-501603, (!counts[i]));
+
+                debugFree(counts, -300597);
+        }
+
+        // unique keys with a hash index, avl_find_item() must return exactly the inserted items:
+        AVL_TREE(hashed_tree, struct fuzz_type, key);
+        struct fuzz_type **ref = debugMallocReset(4096 * sizeof (struct fuzz_type *), -300596);
+
+        avl_hash_index(&hashed_tree, HASH_KEY_MIXED);
+
+        for (i = 0; i < (uint32_t) ops; i++) {
+
+                uint16_t key = rand_num(4096);
+                struct fuzz_type *t = avl_find_item(&hashed_tree, &key);
+
+                assertion(-501614, (t == ref[key]));
+
+                if (t) {
+                        assertion(-501615, (avl_remove(&hashed_tree, &key, -300190) == t));
+                        debugFree(t, -300042);
+                        ref[key] = NULL;
+                } else {
+                        t = ref[key] = debugMalloc(sizeof (struct fuzz_type), -300004);
+                        t->key = key;
+                        t->id = i;
+                        avl_insert(&hashed_tree, t, -300300);
+                }
+
+                assertion(-501616, (hashed_tree.items ? hashed_tree.hash->items == hashed_tree.items : !hashed_tree.hash));
+        }
+
+        for (i = 0; i < 4096; i++) {
+                if (ref[i]) {
+                        assertion(-501617, (avl_find_item(&hashed_tree, &ref[i]->key) == ref[i]));
+                        avl_remove(&hashed_tree, &ref[i]->key, -300190);
+                        debugFree(ref[i], -300042);
+                }
+        }
+
+        assertion(-501618, (!hashed_tree.items && !hashed_tree.hash));
+
+        // secondary index on the duplicate keys of a tree with unique ids, items get re-keyed while linked:
+        static AVL_TREE(id_tree, struct fuzz_type, id);
+        static AVL_INDEX(key_index, struct fuzz_type, key);
+        uint32_t key_counts[16];
+
+        memset(key_counts, 0, sizeof (key_counts));
+        memset(ref, 0, 256 * sizeof (struct fuzz_type *));
+        avl_index_add(&id_tree, &key_index);
+
+        for (i = 0; i < (uint32_t) ops; i++) {
+
+                uint16_t id = rand_num(256), key = rand_num(16);
+                struct fuzz_type *t = ref[id];
+
+                if (!t) {
+                        t = ref[id] = debugMalloc(sizeof (struct fuzz_type), -300004);
+                        t->id = id;
+                        t->key = key;
+                        avl_insert(&id_tree, t, -300300);
+                        key_counts[key]++;
+                } else if (rand_num(2)) {
+                        avl_index_unlink(&id_tree, t);
+                        key_counts[t->key]--;
+                        t->key = key;
+                        key_counts[key]++;
+                        avl_index_link(&id_tree, t);
+                } else {
+                        assertion(-501622, (avl_remove(&id_tree, &id, -300190) == t));
+                        key_counts[t->key]--;
+                        debugFree(t, -300042);
+                        ref[id] = NULL;
+                }
+
+                avl_index_check_one(&key_index);
+
+                key = rand_num(16);
+                t = avl_index_find_item(&key_index, &key);
+
+                assertion_dbg(-501623, (key_counts[key] ? (t && t->key == key) : !t),
+                        "key=%d count=%d found=%p", key, key_counts[key], (void*) t);
+        }
+
+        for (i = 0; i < 256; i++) {
+                if (ref[i]) {
+                        avl_remove(&id_tree, &ref[i]->id, -300190);
+                        debugFree(ref[i], -300042);
+                }
+        }
+
+        assertion(-501624, (!id_tree.items && !key_index.hash));
+        debugFree(ref, -300597);
+
+        printf("avl_fuzz: %d inserts, %d removes, %d ops per key range: OK\n", inserts, removes, ops);
+}
+
+
+#define AVL_BENCH_ROUNDS 20
+
+STATIC_FUNC
+uint32_t avl_bench_usec(struct timespec *start)
+{
+        struct timespec now;
+        uint64_t nsec;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        nsec = ((uint64_t) (now.tv_sec - start->tv_sec)) * 1000000000 + now.tv_nsec - start->tv_nsec;
+        (*start) = now;
+
+        return nsec / 1000;
+}
+
+// in-order step by climbing up pointers, as avl_iterate_item() does without AVL_5XLINKED
+STATIC_FUNC
+void *avl_bench_iterate_up(struct avl_tree *tree, struct avl_node **an)
+{
+        if (!(*an) || (*an)->down[1]) {
+
+                (*an) = (*an) ? (*an)->down[1] : tree->root;
+
+                while ((*an) && (*an)->down[0])
+                        (*an) = (*an)->down[0];
+
+                return (*an) ? (*an)->item : NULL;
+        }
+
+        struct avl_node *prev = (*an);
+
+        while (((*an) = (*an)->up)) {
+
+                if ((*an)->down[0] == prev)
+                        return (*an)->item;
+
+                prev = (*an);
+        }
+
+        return NULL;
+}
+
+/*
+ * Times random lookups in a tree of n items with the layout and key of the given core tree (orig_tree, dhash_tree),
+ * once with allocated and once with embedded avl nodes. Items are allocated right before their insertion as in
+ * init_orig_node() and create_dhash_node().
+ */
+STATIC_FUNC
+float avl_bench_lookup(struct avl_tree *tree, int32_t n, uint32_t item_size, uint32_t *allocs)
+{
+        uint8_t **items = debugMalloc(n * sizeof (uint8_t*), -300596);
+        struct timespec start;
+        uint32_t find_us, r;
+        int32_t i, found = 0;
+
+        srand(n);
+
+        for (i = 0; i < n; i++) {
+                uint8_t *key;
+                items[i] = debugMallocReset(item_size, -300596);
+                (*allocs)++;
+
+                for (key = AVL_ITEM_KEY(tree, items[i]); key < (uint8_t*) AVL_ITEM_KEY(tree, items[i]) + tree->key_size; key++)
+                        *key = rand();
+
+                avl_insert(tree, items[i], -300300);
+                (*allocs) += !tree->intrusive;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (r = 0; r < AVL_BENCH_ROUNDS; r++) {
+                for (i = 0; i < n; i++)
+                        found += !!avl_find(tree, AVL_ITEM_KEY(tree, items[rand_num(n)]));
+        }
+
+        find_us = avl_bench_usec(&start);
+
+        assertion(-501606, (found == n * AVL_BENCH_ROUNDS));
+
+        for (i = 0; i < n; i++) {
+                avl_remove(tree, AVL_ITEM_KEY(tree, items[i]), -300190);
+                debugFree(items[i], -300597);
+        }
+
+        debugFree(items, -300597);
+
+        return (find_us * 1000.0) / ((double) n * AVL_BENCH_ROUNDS);
+}
+
+STATIC_FUNC
+void avl_bench_intrusive(int32_t n)
+{
+        AVL_TREE(orig_alloc_tree, struct orig_node, global_id);
+        AVL_TREE_INTRUSIVE(orig_intrusive_tree, struct orig_node, global_id, orig_tree_an);
+        AVL_TREE(dhash_alloc_tree, struct dhash_node, dhash);
+        AVL_TREE_INTRUSIVE(dhash_intrusive_tree, struct dhash_node, dhash, dhash_tree_an);
+        AVL_TREE_INTRUSIVE(orig_hashed_tree, struct orig_node, global_id, orig_tree_an);
+        AVL_TREE_INTRUSIVE(dhash_hashed_tree, struct dhash_node, dhash, dhash_tree_an);
+        uint32_t allocs[6] = {0, 0, 0, 0, 0, 0};
+        float ns[6];
+
+        avl_hash_index(&orig_hashed_tree, HASH_KEY_MIXED);
+        avl_hash_index(&dhash_hashed_tree, HASH_KEY_RANDOM);
+
+        ns[0] = avl_bench_lookup(&orig_alloc_tree, n, sizeof (struct orig_node), &allocs[0]);
+        ns[1] = avl_bench_lookup(&orig_intrusive_tree, n, sizeof (struct orig_node), &allocs[1]);
+        ns[2] = avl_bench_lookup(&orig_hashed_tree, n, sizeof (struct orig_node), &allocs[2]);
+        ns[3] = avl_bench_lookup(&dhash_alloc_tree, n, sizeof (struct dhash_node), &allocs[3]);
+        ns[4] = avl_bench_lookup(&dhash_intrusive_tree, n, sizeof (struct dhash_node), &allocs[4]);
+        ns[5] = avl_bench_lookup(&dhash_hashed_tree, n, sizeof (struct dhash_node), &allocs[5]);
+
+        printf("                          allocated  intrusive  +hashed\n");
+        printf("orig_tree allocs:        %10u %10u %10u\n", allocs[0], allocs[1], allocs[2]);
+        printf("orig_tree avl_find():    %10.1f %10.1f %10.1f ns\n", ns[0], ns[1], ns[2]);
+        printf("dhash_tree allocs:       %10u %10u %10u\n", allocs[3], allocs[4], allocs[5]);
+        printf("dhash_tree avl_find():   %10.1f %10.1f %10.1f ns\n", ns[3], ns[4], ns[5]);
+}
+
+STATIC_FUNC
+int avl_bench_memcmp(const void *a, const void *b, uint32_t size)
+{
+        return memcmp(a, b, size);
+}
+
+/*
+ * Times insert and find of up to n items with keys of each inline compared size, once with the inline
+ * comparators and once with memcmp(). Also checks that both give the same order for keys with common prefixes.
+ */
+STATIC_FUNC
+void avl_bench_cmp(int32_t n)
+{
+#define AVL_BENCH_KEY_MAX 20
+        struct cmp_bench_type {
+                uint8_t key[AVL_BENCH_KEY_MAX];
+        };
+
+        uint32_t sizes[] = {1, 2, 4, 8, 16, 20};
+        struct cmp_bench_type *items = debugMalloc(n * sizeof (struct cmp_bench_type), -300596);
+        struct timespec start;
+        uint32_t s, v, r;
+        int32_t i, j;
+
+        printf("key bytes  items    insert ns (memcmp/inline)     find ns (memcmp/inline)\n");
+
+        for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+
+                uint32_t size = sizes[s];
+                int32_t m = (size == 1) ? XMIN(n, 256) : ((size == 2) ? XMIN(n, 65536) : n);
+                float insert_ns[2], find_ns[2];
+
+                AVL_TREE(cmp_tree, struct cmp_bench_type, key);
+                cmp_tree.key_size = size;
+
+                srand(n + size);
+
+                // distinct keys sharing random prefixes, small keys by shuffled counting:
+                for (i = 0; i < m; i++) {
+
+                        for (j = 0; j < AVL_BENCH_KEY_MAX; j++)
+                                items[i].key[j] = (i && rand_num(4)) ? items[i - 1].key[j] : rand();
+
+                        if (size <= 2) {
+                                items[i].key[0] = (size == 1) ? i : (i >> 8);
+                                items[i].key[1] = i;
+                        }
+                }
+
+                for (i = 1; i < m; i++) {
+                        uint8_t *a = items[i - 1].key, *b = items[i].key;
+                        int c = memcmp(a, b, size);
+
+                        cmp_tree.cmp = NULL;
+                        assertion(-501607, ((c > 0) - (c < 0) == avl_cmp(&cmp_tree, a, b)));
+                        assertion(-501608, (!avl_cmp(&cmp_tree, a, a)));
+                }
+
+                for (v = 0; v < 2; v++) {
+
+                        int32_t inserted = 0, found = 0;
+
+                        cmp_tree.cmp = v ? NULL : avl_bench_memcmp;
+
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+
+                        for (i = 0; i < m; i++) {
+                                if (!avl_find(&cmp_tree, items[i].key)) {
+                                        avl_insert(&cmp_tree, &items[i], -300300);
+                                        inserted++;
+                                }
+                        }
+
+                        insert_ns[v] = (avl_bench_usec(&start) * 1000.0) / m;
+
+                        for (r = 0; r < AVL_BENCH_ROUNDS; r++) {
+                                for (i = 0; i < m; i++)
+                                        found += !!avl_find(&cmp_tree, items[(i * 7919) % m].key);
+                        }
+
+                        find_ns[v] = (avl_bench_usec(&start) * 1000.0) / ((double) m * AVL_BENCH_ROUNDS);
+
+                        assertion(-501609, (found == m * (int32_t) AVL_BENCH_ROUNDS));
+
+                        avl_check(&cmp_tree);
+
+                        while (avl_remove_first_item(&cmp_tree, -300190));
+                }
+
+                printf("%9d %6d %12.1f %12.1f %14.1f %12.1f\n", size, m, insert_ns[0], insert_ns[1], find_ns[0], find_ns[1]);
+        }
+
+        debugFree(items, -300597);
+}
+
+/*
+ * Times inserting n items with random keys, iterating the whole tree, and removing all items in random order.
+ */
+STATIC_FUNC
+void avl_bench(int32_t n)
+{
+        struct bench_type {
+                uint32_t key;
+        };
+
+        AVL_TREE(bench_tree, struct bench_type, key);
+        struct bench_type *items = debugMalloc(n * sizeof (struct bench_type), -300596);
+        uint32_t *keys = debugMalloc(n * sizeof (uint32_t), -300596);
+        struct bench_type *b;
+        struct avl_node *an;
+        struct timespec start;
+        uint32_t insert_us, remove_us, thread_us, up_us, r;
+        uintptr_t sum = 0;
+        int32_t i;
+
+        srand(n);
+
+        for (i = 0; i < n; i++)
+                items[i].key = (((uint32_t) rand()) << 16) ^ rand();
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0; i < n; i++) {
+                if (!avl_find(&bench_tree, &items[i].key))
+                        avl_insert(&bench_tree, &items[i], -300300);
+        }
+
+        insert_us = avl_bench_usec(&start);
+
+        for (r = 0; r < AVL_BENCH_ROUNDS; r++) {
+                for (an = NULL; (b = avl_iterate_item(&bench_tree, &an));)
+                        sum += (uintptr_t) b; // only the traversal, items are not touched
+        }
+
+        thread_us = avl_bench_usec(&start);
+
+        for (r = 0; r < AVL_BENCH_ROUNDS; r++) {
+                for (an = NULL; (b = avl_bench_iterate_up(&bench_tree, &an));)
+                        sum -= (uintptr_t) b;
+        }
+
+        up_us = avl_bench_usec(&start);
+
+        assertion(-501604, (!sum));
+
+        // remove in random order, the items themselves must stay in place while linked:
+        for (i = 0; i < n; i++)
+                keys[i] = items[i].key;
+
+        for (i = n - 1; i > 0; i--) {
+                uint32_t j = rand_num(i + 1), k = keys[i];
+                keys[i] = keys[j];
+                keys[j] = k;
+        }
+
+        avl_bench_usec(&start);
+
+        for (i = 0; i < n; i++)
+                avl_remove(&bench_tree, &keys[i], -300190);
+
+        remove_us = avl_bench_usec(&start);
+
+        assertion(-501605, (!bench_tree.items));
+
+#ifdef AVL_5XLINKED
+        printf("avl_bench items=%d (AVL_5XLINKED):\n", n);
+#else
+        printf("avl_bench items=%d (NO_AVL_5XLINKED):\n", n);
+#endif
+        printf("insert:                %8.1f ns/item\n", (insert_us * 1000.0) / n);
+        printf("remove:                %8.1f ns/item\n", (remove_us * 1000.0) / n);
+        printf("avl_iterate_item():    %8.1f ns/step\n", (thread_us * 1000.0) / ((double) n * AVL_BENCH_ROUNDS));
+        printf("up-pointer walk:       %8.1f ns/step\n", (up_us * 1000.0) / ((double) n * AVL_BENCH_ROUNDS));
+
+        debugFree(keys, -300597);
+        debugFree(items, -300597);
+
+        avl_bench_intrusive(n);
+
+        avl_bench_cmp(n);
+}
+
+
 static int32_t tree_max = 5;
+static int32_t tree_fuzz_ops = 10000;
+static int32_t tree_bench_items = 10000;
+
 static int32_t opt_tree ( uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn ) {
 
-	if ( cmd == OPT_APPLY )
-		avl_test(tree_max);
+	if ( cmd == OPT_APPLY ) {
+
+		if (!strcmp(opt->name, "treeFuzz")) {
+			avl_fuzz(tree_fuzz_ops);
+			cleanup_all(CLEANUP_SUCCESS);
+		} else if (!strcmp(opt->name, "treeBench")) {
+			avl_bench(tree_bench_items);
+			cleanup_all(CLEANUP_SUCCESS);
+		} else {
+			avl_test(tree_max);
+		}
+	}
 
 	return SUCCESS;
 }
@@ -835,7 +1531,11 @@ static struct opt_type msg_options[]=
 //        ord parent long_name          shrt Attributes				*ival		min		max		default		*func,*syntax,*help
 
 	{ODI,0,"tree",  	        0, 9,0,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&tree_max,	0,	        20,	        1,0,	        opt_tree,
-			ARG_VALUE_FORM,	"show tree with given number of elements"}
+			ARG_VALUE_FORM,	"show tree with given number of elements"},
+	{ODI,0,"treeFuzz",  	        0, 9,0,A_PS1,A_ADM,A_INI,A_ARG,A_ANY,	&tree_fuzz_ops,	1,	        10000000,	10000,0,	opt_tree,
+			ARG_VALUE_FORM,	"check tree structure after each of given number of random inserts and removes per key range"},
+	{ODI,0,"treeBench",  	        0, 9,0,A_PS1,A_ADM,A_INI,A_ARG,A_ANY,	&tree_bench_items,	1,	10000000,	10000,0,	opt_tree,
+			ARG_VALUE_FORM,	"benchmark insert, iterate, and remove with given number of tree items"}
 
 };
 
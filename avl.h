@@ -28,10 +28,16 @@
 #define _AVL_H
 
 #include <stdint.h>
+#include <string.h>
 
 
 #define AVL_MAX_HEIGHT 128
 
+// threaded layout: first/last and in-order left/right links make avl_first_item() and avl_iterate_item() O(1)
+#ifndef NO_AVL_5XLINKED
+#define AVL_5XLINKED
+#endif
+
 
 struct avl_node {
         void *item;
@@ -50,6 +56,41 @@ struct avl_node {
 // obtain key pointer based on item pointer
 #define AVL_ITEM_KEY( a_tree, a_item ) ( (void*) ( ((char*)(a_item))+((a_tree)->key_offset) ) )
 
+// obtain embedded avl_node pointer based on item pointer (intrusive trees only)
+#define AVL_ITEM_NODE( a_tree, a_item ) ( (struct avl_node*) ( ((char*)(a_item))+((a_tree)->node_offset) ) )
+
+struct hash_index;
+struct avl_tree;
+
+/*
+ * Secondary index of a tree: finds items by the value of another (not necessarily unique) field.
+ * Declared with AVL_INDEX() and attached with avl_index_add(), it is then maintained by avl_insert() and
+ * avl_remove(). The indexed field of an item in the tree must only be changed between avl_index_unlink()
+ * and avl_index_link().
+ */
+struct avl_index {
+	struct avl_index *next; // further index of the same tree
+	struct avl_index *all;  // any other index, for avl_index_check()
+	struct avl_tree *tree;
+	uint16_t key_size;
+	uint16_t key_offset;
+	struct hash_index *hash; // exists while the tree has items
+};
+
+#define AVL_INDEX(index, element_type, key_field) struct avl_index (index) =  { \
+                   .key_size = (sizeof( (((element_type *) 0)->key_field) )), \
+                   .key_offset = ((unsigned long)(&(((element_type *)0)->key_field))) }
+
+// optional key comparator with memcmp() semantics, see AVL_TREE_CMP()
+typedef int (*avl_cmp_t) (const void *a, const void *b, uint32_t size);
+
+/*
+ * Trees initialized with AVL_TREE_INTRUSIVE() or AVL_INIT_TREE_INTRUSIVE() use the struct avl_node embedded
+ * in each item instead of allocating one per avl_insert(). An item can be in one such tree per embedded node.
+ * Otherwise they are used with the same avl_*() functions.
+ * Trees with unique keys can get a hash index with avl_hash_index(), avl_find() and avl_find_item() are then O(1).
+ */
+
 struct avl_tree {
 	struct avl_node *root;
 #ifdef AVL_5XLINKED
@@ -58,39 +99,41 @@ struct avl_tree {
 #endif
 	uint16_t key_size;
 	uint16_t key_offset;
+	uint16_t node_offset;
+	uint16_t intrusive;
 	uint32_t items;
+	avl_cmp_t cmp; // NULL: memcmp() order with inline comparison of 1, 2, 4, 8, 16, and 20 byte keys
+	uint8_t hashed; // HASH_KEY_* of the exact-match index set by avl_hash_index()
+	struct hash_index *hash; // exists while the tree has items
+	struct avl_index *indexes; // secondary indexes added with avl_index_add()
 };
 
-#ifdef AVL_5XLINKED
-
-#define AVL_INIT_TREE(tree, element_type, key_field) do { \
-                          tree.root = NULL; \
-			  tree.first = NULL; \
-			  tree.last = NULL; \
+#define AVL_INIT_TREE_INTRUSIVE(tree, element_type, key_field, node_field) do { \
+                          memset(&(tree), 0, sizeof (struct avl_tree)); \
                           tree.key_size = sizeof( (((element_type *) 0)->key_field) ); \
                           tree.key_offset = ((unsigned long) (&((element_type *) 0)->key_field)); \
-                          tree.items = 0; \
+                          tree.node_offset = ((unsigned long) (&((element_type *) 0)->node_field)); \
+                          tree.intrusive = 1; \
                       } while (0)
 
-#define AVL_TREE(tree, element_type, key_field) struct avl_tree (tree) =  { \
-                   NULL, NULL, NULL, \
-                   (sizeof( (((element_type *) 0)->key_field) )), \
-                   ((unsigned long)(&(((element_type *)0)->key_field))), \
-                   0 }
-#else
 #define AVL_INIT_TREE(tree, element_type, key_field) do { \
-                          tree.root = NULL; \
+                          memset(&(tree), 0, sizeof (struct avl_tree)); \
                           tree.key_size = sizeof( (((element_type *) 0)->key_field) ); \
                           tree.key_offset = ((unsigned long) (&((element_type *) 0)->key_field)); \
-                          tree.items = 0; \
                       } while (0)
 
-#define AVL_TREE(tree, element_type, key_field) struct avl_tree (tree) =  { \
-                   NULL, \
-                   (sizeof( (((element_type *) 0)->key_field) )), \
-                   ((unsigned long)(&(((element_type *)0)->key_field))), \
-                   0 }
-#endif
+#define AVL_TREE_INTRUSIVE(tree, element_type, key_field, node_field) struct avl_tree (tree) =  { \
+                   .key_size = (sizeof( (((element_type *) 0)->key_field) )), \
+                   .key_offset = ((unsigned long)(&(((element_type *)0)->key_field))), \
+                   .node_offset = ((unsigned long)(&(((element_type *)0)->node_field))), \
+                   .intrusive = 1 }
+
+#define AVL_TREE_CMP(tree, element_type, key_field, cmp_func) struct avl_tree (tree) =  { \
+                   .key_size = (sizeof( (((element_type *) 0)->key_field) )), \
+                   .key_offset = ((unsigned long)(&(((element_type *)0)->key_field))), \
+                   .cmp = (cmp_func) }
+
+#define AVL_TREE(tree, element_type, key_field) AVL_TREE_CMP(tree, element_type, key_field, NULL)
 
 #define avl_height(p) ((p) == NULL ? -1 : (p)->balance)
 #define avl_max(a,b) ((a) > (b) ? (a) : (b))
@@ -101,11 +144,15 @@ void            *avl_find_item( struct avl_tree *tree, void *key );
 void            *avl_next_item(struct avl_tree *tree, void *key);
 void            *avl_first_item(struct avl_tree *tree);
 void            *avl_iterate_item(struct avl_tree *tree, struct avl_node **it );
-void           *_avl_find_item_by_field(struct avl_tree *tree, void *value, unsigned long offset, uint32_t size);
-#define          avl_find_item_by_field(tree,val,s,field) _avl_find_item_by_field( tree, val, (unsigned long)((&(((struct s*)0)->field))), sizeof(((struct s*)0)->field) )
 void             avl_insert(struct avl_tree *tree, void *node, int32_t tag);
 void            *avl_remove(struct avl_tree *tree, void *key, int32_t tag);
 void            *avl_remove_first_item(struct avl_tree *tree, int32_t tag);
+void             avl_hash_index(struct avl_tree *tree, uint8_t hash_key);
+void             avl_index_add(struct avl_tree *tree, struct avl_index *index);
+void            *avl_index_find_item(struct avl_index *index, void *value);
+void             avl_index_unlink(struct avl_tree *tree, void *item);
+void             avl_index_link(struct avl_tree *tree, void *item);
+void             avl_index_check(void);
 void             init_avl(void);
 
 #ifdef AVL_DEBUG
@@ -117,6 +164,9 @@ struct avl_iterator {
 
 struct avl_node *avl_iter(struct avl_tree *tree, struct avl_iterator *it );
 void avl_debug( struct avl_tree *tree );
+#endif
+
+#ifdef AVL_TEST
 void avl_test(int m);
 #endif
 
@@ -0,0 +1,682 @@
+/*
+ * Copyright (c) 2010  Axel Neumann
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ */
+
+/*
+ * Standalone microbenchmarks of the core data structures: make bench
+ *
+ * Links only avl.c, hash.c, list.c, iid.c, tools.c, metrics.c, and allocate.c (plus the stubs below for what
+ * they reference from the rest of bmx6), so it needs neither root nor network.
+ * Each result is one tab-separated line: name, items, ops, nsec per op. Lines starting with # are comments.
+ * An optional argument scales the number of ops (default 1, e.g. 0.1 for a quick run).
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bmx.h"
+#include "msg.h"
+#include "ip.h"
+#include "plugin.h"
+#include "tools.h"
+#include "metrics.h"
+#include "iid.h"
+#include "list.h"
+#include "avl.h"
+#include "hash.h"
+
+#define CODE_CATEGORY_NAME "bench"
+
+#define BENCH_OPS_MIN 200000 // ops per measurement, items of small sizes are processed in several rounds
+
+
+
+/***********************************************************
+ stubs for what the linked modules reference from the rest of bmx6
+************************************************************/
+
+IDM_T terminating = 0;
+TIME_T bmx_time = 0;
+TIME_SEC_T bmx_time_sec = 0;
+IDM_T my_description_changed = NO;
+
+AVL_TREE(local_tree, struct local_node, local_id);
+AVL_TREE(link_dev_tree, struct link_dev_node, key);
+
+struct frame_handl description_tlv_handl[BMX_DSC_TLV_ARRSZ];
+
+const IPX_T ZERO_IP = { { { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 } } };
+
+void cleanup_all(int32_t status)
+{
+        fprintf(stderr, "# bench terminated with status %d\n", status);
+        exit(status == CLEANUP_SUCCESS ? 0 : 1);
+}
+
+#ifndef NO_TRACE_FUNCTION_CALLS
+void trace_function_call(const char *func)
+{
+}
+#endif
+
+#ifndef TEST_DEBUG
+STATIC_FUNC
+void bench_vdbg(int8_t dbgl, int8_t dbgt, const char *f, char *last, va_list ap)
+{
+        if (dbgl != DBGL_SYS || dbgt != DBGT_ERR)
+                return;
+
+        fprintf(stderr, "# %s: ", f ? f : "");
+        vfprintf(stderr, last, ap);
+        fprintf(stderr, "\n");
+}
+
+void dbg(int8_t dbgl, int8_t dbgt, char *last, ...)
+{
+        va_list ap;
+        va_start(ap, last);
+        bench_vdbg(dbgl, dbgt, NULL, last, ap);
+        va_end(ap);
+}
+
+void _dbgf(int8_t dbgl, int8_t dbgt, const char *f, char *last, ...)
+{
+        va_list ap;
+        va_start(ap, last);
+        bench_vdbg(dbgl, dbgt, f, last, ap);
+        va_end(ap);
+}
+
+void dbg_cn(struct ctrl_node *cn, int8_t dbgl, int8_t dbgt, char *last, ...)
+{
+        va_list ap;
+        va_start(ap, last);
+        bench_vdbg(dbgl, dbgt, NULL, last, ap);
+        va_end(ap);
+}
+
+void _dbgf_cn(struct ctrl_node *cn, int8_t dbgl, int8_t dbgt, const char *f, char *last, ...)
+{
+        va_list ap;
+        va_start(ap, last);
+        bench_vdbg(dbgl, dbgt, f, last, ap);
+        va_end(ap);
+}
+
+void dbg_mute(uint32_t check_len, int8_t dbgl, int8_t dbgt, char *last, ...)
+{
+        va_list ap;
+        va_start(ap, last);
+        bench_vdbg(dbgl, dbgt, NULL, last, ap);
+        va_end(ap);
+}
+
+void _dbgf_mute(uint32_t check_len, int8_t dbgl, int8_t dbgt, const char *f, char *last, ...)
+{
+        va_list ap;
+        va_start(ap, last);
+        bench_vdbg(dbgl, dbgt, f, last, ap);
+        va_end(ap);
+}
+
+void _dbgf_all(int8_t dbgt, const char *f, char *last, ...)
+{
+}
+
+void dbg_printf(struct ctrl_node *cn, char *last, ...)
+{
+}
+#endif
+
+uint8_t __dbgf_all(void)
+{
+        return NO;
+}
+
+uint8_t __dbgf_track(void)
+{
+        return NO;
+}
+
+char *globalIdAsString(struct GLOBAL_ID *id)
+{
+        return id ? id->name : DBG_NIL;
+}
+
+char *ipFAsStr(const IPX_T *addr)
+{
+        return DBG_NIL;
+}
+
+char *family2Str(uint8_t family)
+{
+        return DBG_NIL;
+}
+
+IPX_T ip4ToX(IP4_T ip4)
+{
+        IPX_T ip = ZERO_IP;
+        ip.s6_addr32[3] = ip4;
+        return ip;
+}
+
+IDM_T ip_netmask_validate(IPX_T *ipX, uint8_t mask, uint8_t family, uint8_t force)
+{
+        return SUCCESS;
+}
+
+IDM_T validate_param(int32_t probe, int32_t min, int32_t max, char *name)
+{
+        return (probe >= min && probe <= max) ? SUCCESS : FAILURE;
+}
+
+TIME_T get_rx_time(struct timespec *rx_stamp)
+{
+        return bmx_time;
+}
+
+void register_options_array(struct opt_type *fixed_options, int size, const char *category_name)
+{
+}
+
+void register_status_handl(uint16_t min_msg_size, IDM_T multiline, const struct field_format* format, char *name,
+                            int32_t(*creator) (struct status_handl *status_handl, void *data))
+{
+}
+
+void register_frame_handler(struct frame_handl *array, int pos, struct frame_handl *handl)
+{
+}
+
+void cb_plugin_hooks(int32_t cb_id, void* data)
+{
+}
+
+void cb_route_change_hooks(uint8_t del, struct orig_node *dest)
+{
+}
+
+void status_orig_changed(struct orig_node *on)
+{
+}
+
+void status_local_changed(struct local_node *local)
+{
+}
+
+OGM_SQN_T set_ogmSqn_toBeSend_and_aggregated(struct orig_node *on, UMETRIC_T um, OGM_SQN_T to_be_send, OGM_SQN_T aggregated)
+{
+        return to_be_send;
+}
+
+void schedule_orig_router_purge(struct orig_node *on)
+{
+}
+
+
+
+/***********************************************************
+ benchmarks
+************************************************************/
+
+static double bench_scale = 1;
+static volatile uint64_t bench_sink; // keeps results of otherwise unused lookups alive
+
+STATIC_FUNC
+uint64_t bench_nsec(struct timespec *start)
+{
+        struct timespec now;
+        uint64_t nsec;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        nsec = ((uint64_t) (now.tv_sec - start->tv_sec)) * 1000000000 + now.tv_nsec - start->tv_nsec;
+        (*start) = now;
+
+        return nsec;
+}
+
+STATIC_FUNC
+uint32_t bench_rounds(uint32_t items)
+{
+        uint32_t ops = BENCH_OPS_MIN * bench_scale;
+
+        return items >= ops ? 1 : (ops + items - 1) / items;
+}
+
+STATIC_FUNC
+void bench_print(char *name, uint32_t items, uint64_t ops, uint64_t nsec)
+{
+        printf("%s\t%u\t%ju\t%.1f\n", name, items, (uintmax_t) ops, ops ? ((double) nsec) / ops : 0.0);
+}
+
+STATIC_FUNC
+void bench_shuffle(void **array, uint32_t n)
+{
+        uint32_t i;
+
+        for (i = n - 1; i > 0; i--) {
+                uint32_t j = rand_num(i + 1);
+                void *tmp = array[i];
+                array[i] = array[j];
+                array[j] = tmp;
+        }
+}
+
+
+
+struct bench_orig {
+        GLOBAL_ID_T global_id;
+        struct avl_node an; // for the intrusive variant
+        uint32_t sum;
+};
+
+/*
+ * Insert, find, iterate, and remove of originator-like items (keyed by 52-byte global ids) in a plain tree,
+ * one with embedded nodes, and one with a hash index as orig_tree has.
+ */
+STATIC_FUNC
+void bench_avl(uint32_t n, uint8_t variant)
+{
+        static char *names[] = {"avl", "avl_intrusive", "avl_hashed"};
+        char name[64];
+        struct avl_tree tree;
+        struct bench_orig *items = debugMallocReset(n * sizeof (struct bench_orig), -300602);
+        struct bench_orig **order = debugMalloc(n * sizeof (struct bench_orig *), -300602);
+        struct bench_orig *o;
+        struct avl_node *an;
+        struct timespec start;
+        uint64_t insert_ns = 0, find_ns = 0, iterate_ns = 0, remove_ns = 0;
+        uint32_t rounds = bench_rounds(n), r, i;
+
+        if (variant == 1)
+                AVL_INIT_TREE_INTRUSIVE(tree, struct bench_orig, global_id, an);
+        else
+                AVL_INIT_TREE(tree, struct bench_orig, global_id);
+
+        if (variant == 2)
+                avl_hash_index(&tree, HASH_KEY_MIXED);
+
+        for (i = 0; i < n; i++) {
+                snprintf(items[i].global_id.name, sizeof (items[i].global_id.name), "node%u.mesh", i);
+                uint32_t rnd = rand();
+                memcpy(&items[i].global_id.pkid.u8[0], &rnd, sizeof (rnd));
+                memcpy(&items[i].global_id.pkid.u8[4], &i, sizeof (i));
+                order[i] = &items[i];
+        }
+
+        for (r = 0; r < rounds; r++) {
+
+                bench_shuffle((void**) order, n);
+                bench_nsec(&start);
+
+                for (i = 0; i < n; i++)
+                        avl_insert(&tree, order[i], -300300);
+
+                insert_ns += bench_nsec(&start);
+
+                for (i = 0; i < n; i++)
+                        bench_sink += ((struct bench_orig*) avl_find_item(&tree, &order[n - 1 - i]->global_id))->sum;
+
+                find_ns += bench_nsec(&start);
+
+                for (an = NULL; (o = avl_iterate_item(&tree, &an));)
+                        bench_sink += o->sum;
+
+                iterate_ns += bench_nsec(&start);
+
+                for (i = 0; i < n; i++)
+                        avl_remove(&tree, &order[i]->global_id, -300190);
+
+                remove_ns += bench_nsec(&start);
+
+                assertion(-501625, (!tree.items));
+        }
+
+        sprintf(name, "%s_insert", names[variant]);
+        bench_print(name, n, (uint64_t) n * rounds, insert_ns);
+        sprintf(name, "%s_find", names[variant]);
+        bench_print(name, n, (uint64_t) n * rounds, find_ns);
+        sprintf(name, "%s_iterate", names[variant]);
+        bench_print(name, n, (uint64_t) n * rounds, iterate_ns);
+        sprintf(name, "%s_remove", names[variant]);
+        bench_print(name, n, (uint64_t) n * rounds, remove_ns);
+
+        debugFree(order, -300603);
+        debugFree(items, -300603);
+}
+
+
+struct bench_list_item {
+        struct list_node list;
+        uint32_t key;
+};
+
+/*
+ * Append, iterate, and remove from the head of a list, as done for queued frames and task lists.
+ */
+STATIC_FUNC
+void bench_list(uint32_t n)
+{
+        LIST_SIMPEL(list, struct bench_list_item, list, key);
+        struct bench_list_item *items = debugMallocReset(n * sizeof (struct bench_list_item), -300602);
+        struct bench_list_item *li;
+        struct timespec start;
+        uint64_t add_ns = 0, iterate_ns = 0, del_ns = 0;
+        uint32_t rounds = bench_rounds(n), r, i;
+
+        for (r = 0; r < rounds; r++) {
+
+                bench_nsec(&start);
+
+                for (i = 0; i < n; i++)
+                        list_add_tail(&list, &items[i].list);
+
+                add_ns += bench_nsec(&start);
+
+                for (li = NULL; (li = list_iterate(&list, li));)
+                        bench_sink += li->key;
+
+                iterate_ns += bench_nsec(&start);
+
+                while ((li = list_del_head(&list)))
+                        bench_sink += li->key;
+
+                del_ns += bench_nsec(&start);
+
+                assertion(-501626, (!list.items));
+        }
+
+        bench_print("list_add_tail", n, (uint64_t) n * rounds, add_ns);
+        bench_print("list_iterate", n, (uint64_t) n * rounds, iterate_ns);
+        bench_print("list_del_head", n, (uint64_t) n * rounds, del_ns);
+
+        debugFree(items, -300603);
+}
+
+
+/*
+ * Fills my_iid_repos with n description hashes, then frees a random one and allocates a new one ops times.
+ */
+STATIC_FUNC
+void bench_iid(uint32_t n)
+{
+        struct dhash_node *dhns = debugMallocReset(n * sizeof (struct dhash_node), -300602);
+        struct timespec start;
+        uint64_t fill_ns = 0, churn_ns, free_ns = 0;
+        uint32_t rounds = bench_rounds(n), ops = BENCH_OPS_MIN * bench_scale, r, i;
+
+        for (r = 0; r < rounds; r++) {
+
+                bench_nsec(&start);
+
+                for (i = 0; i < n; i++)
+                        dhns[i].myIID4orig = iid_new_myIID4x(&dhns[i]);
+
+                fill_ns += bench_nsec(&start);
+
+                if (r + 1 < rounds) {
+
+                        for (i = 0; i < n; i++)
+                                iid_free(&my_iid_repos, dhns[i].myIID4orig);
+
+                        free_ns += bench_nsec(&start);
+                }
+        }
+
+        bench_nsec(&start);
+
+        for (i = 0; i < ops; i++) {
+                struct dhash_node *dhn = &dhns[rand_num(n)];
+                iid_free(&my_iid_repos, dhn->myIID4orig);
+                dhn->myIID4orig = iid_new_myIID4x(dhn);
+        }
+
+        churn_ns = bench_nsec(&start);
+
+        for (i = 0; i < n; i++)
+                iid_free(&my_iid_repos, dhns[i].myIID4orig);
+
+        free_ns += bench_nsec(&start);
+
+        assertion(-501627, (!my_iid_repos.arr_size));
+
+        bench_print("iid_new_myIID4x", n, (uint64_t) n * rounds, fill_ns);
+        bench_print("iid_free", n, (uint64_t) n * rounds, free_ns);
+        bench_print("iid_churn", n, ops, churn_ns);
+
+        debugFree(dhns, -300603);
+}
+
+
+STATIC_FUNC
+uint32_t bench_iid_repos_bytes(struct iid_repos *rep)
+{
+        uint32_t bytes = (rep->arr_size / 8) + (rep->arr_size * sizeof (void*) / (rep == &my_iid_repos ? 1 : IID_REPOS_WORD_BITS));
+        uint32_t w;
+
+        for (w = 0; rep != &my_iid_repos && w < rep->arr_size / IID_REPOS_WORD_BITS; w++)
+                bytes += ((__builtin_popcount(rep->used[w]) + IID_REPOS_PAGE_STEP - 1) / IID_REPOS_PAGE_STEP) *
+                IID_REPOS_PAGE_STEP * sizeof (struct iid_ref);
+
+        return bytes;
+}
+
+/*
+ * Models one neighbour in a mesh of n originators: my_iid_repos holds all n, the neighbour maps every
+ * spread-th IID of its own n-sized IID space to one of mine (spread=1 is a neighbour announcing the whole mesh).
+ * Times mapping, looking up, and unmapping by myIID4x, and reports the memory of both repositories.
+ */
+STATIC_FUNC
+void bench_iid_neigh(uint32_t n, uint32_t spread)
+{
+        static struct orig_node on;
+        struct dhash_node *dhns = debugMallocReset(n * sizeof (struct dhash_node), -300602);
+        struct neigh_node *nn = debugMallocReset(sizeof (struct neigh_node), -300602);
+        struct timespec start;
+        uint32_t used = n / spread, ops = BENCH_OPS_MIN * bench_scale, i;
+        uint64_t set_ns, get_ns, free_ns;
+        char name[32];
+
+        for (i = 0; i < n; i++) {
+                dhns[i].on = &on;
+                dhns[i].myIID4orig = iid_new_myIID4x(&dhns[i]);
+        }
+
+        bench_nsec(&start);
+
+        for (i = 0; i < used; i++)
+                iid_set_neighIID4x(&nn->neighIID4x_repos, 1 + i * spread, dhns[(i * 7919) % n].myIID4orig);
+
+        set_ns = bench_nsec(&start);
+
+        for (i = 0; i < ops; i++)
+                bench_sink += (uintptr_t) iid_get_node_by_neighIID4x(nn, 1 + rand_num(used) * spread, NO);
+
+        get_ns = bench_nsec(&start);
+
+        printf("# iid memory n=%d: my_iid_repos %d bytes, neighIID4x_repos with %d of %d used %d bytes\n",
+                n, bench_iid_repos_bytes(&my_iid_repos), used, n, bench_iid_repos_bytes(&nn->neighIID4x_repos));
+
+        bench_nsec(&start);
+
+        for (i = 0; i < used; i++)
+                iid_free_neighIID4x_by_myIID4x(&nn->neighIID4x_repos, dhns[(i * 7919) % n].myIID4orig);
+
+        free_ns = bench_nsec(&start);
+
+        assertion(-501630, (!nn->neighIID4x_repos.arr_size));
+
+        for (i = 0; i < n; i++)
+                iid_free(&my_iid_repos, dhns[i].myIID4orig);
+
+        sprintf(name, "iid_neigh_set/%d", spread);
+        bench_print(name, n, used, set_ns);
+        sprintf(name, "iid_neigh_get/%d", spread);
+        bench_print(name, n, ops, get_ns);
+        sprintf(name, "iid_neigh_free/%d", spread);
+        bench_print(name, n, used, free_ns);
+
+        debugFree(nn, -300603);
+        debugFree(dhns, -300603);
+}
+
+
+/*
+ * Slides a hello sequence-number window as update_link_probe_record() does: count and clear the bits that
+ * fall out of the window and set the new one. Then counts the whole window.
+ */
+STATIC_FUNC
+void bench_bits(void)
+{
+        uint8_t window[MAX_HELLO_SQN_WINDOW / 8];
+        HELLO_SQN_T sqn = 0, min = 0;
+        struct timespec start;
+        uint32_t ops = 10 * BENCH_OPS_MIN * bench_scale, i;
+        uint64_t slide_ns, window_ns;
+
+        memset(window, 0, sizeof (window));
+
+        bench_nsec(&start);
+
+        for (i = 0; i < ops; i++) {
+
+                sqn += 1 + (i % 3);
+
+                if (((HELLO_SQN_T) (sqn - min)) >= MAX_HELLO_SQN_WINDOW) {
+
+                        HELLO_SQN_T new_min = sqn - MAX_HELLO_SQN_WINDOW + 1;
+
+                        bench_sink += bits_get(window, MAX_HELLO_SQN_WINDOW, min, new_min - 1);
+                        bits_clear(window, MAX_HELLO_SQN_WINDOW, min, new_min - 1, HELLO_SQN_MASK);
+                        min = new_min;
+                }
+
+                bit_set(window, MAX_HELLO_SQN_WINDOW, sqn, 1);
+        }
+
+        slide_ns = bench_nsec(&start);
+
+        for (i = 0; i < ops; i++)
+                bench_sink += bits_get(window, MAX_HELLO_SQN_WINDOW, i, i + MAX_HELLO_SQN_WINDOW - 1);
+
+        window_ns = bench_nsec(&start);
+
+        bench_print("bits_slide", MAX_HELLO_SQN_WINDOW, ops, slide_ns);
+        bench_print("bits_get_window", MAX_HELLO_SQN_WINDOW, ops, window_ns);
+}
+
+
+/*
+ * Converts metrics spread evenly over all exponents to the 16-bit float format and back.
+ */
+STATIC_FUNC
+void bench_metrics(void)
+{
+#define BENCH_METRICS 4096
+        UMETRIC_T *um = debugMalloc(BENCH_METRICS * sizeof (UMETRIC_T), -300602);
+        FMETRIC_U16_T *fm = debugMalloc(BENCH_METRICS * sizeof (FMETRIC_U16_T), -300602);
+        struct timespec start;
+        uint32_t rounds = bench_rounds(BENCH_METRICS) * 10, r, i;
+        uint64_t to_f_ns, to_u_ns;
+
+        for (i = 0; i < BENCH_METRICS; i++) {
+                um[i] = UMETRIC_MIN__NOT_ROUTABLE + (((((UMETRIC_T) rand()) << 33) ^ (((UMETRIC_T) rand()) << 2)) >> rand_num(64));
+                um[i] = XMIN(um[i], UMETRIC_MAX);
+        }
+
+        bench_nsec(&start);
+
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < BENCH_METRICS; i++)
+                        fm[i] = umetric_to_fmetric(um[i] + r);
+        }
+
+        to_f_ns = bench_nsec(&start);
+
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < BENCH_METRICS; i++)
+                        bench_sink += fmetric_to_umetric(fm[i]);
+        }
+
+        to_u_ns = bench_nsec(&start);
+
+        bench_print("umetric_to_fmetric", BENCH_METRICS, (uint64_t) BENCH_METRICS * rounds, to_f_ns);
+        bench_print("fmetric_to_umetric", BENCH_METRICS, (uint64_t) BENCH_METRICS * rounds, to_u_ns);
+
+        debugFree(fm, -300603);
+        debugFree(um, -300603);
+}
+
+
+int main(int argc, char *argv[])
+{
+        uint32_t sizes[] = {100, 1000, 10000, 100000};
+        uint32_t meshes[] = {500, 2000, 10000};
+        uint32_t s;
+
+        if (argc > 1 && (bench_scale = strtod(argv[1], NULL)) <= 0) {
+                fprintf(stderr, "usage: %s [ops scale factor, default 1]\n", argv[0]);
+                return 1;
+        }
+
+        srand(1);
+        init_tools();
+
+        printf("# bmx6 bench rev=%s"
+#ifdef DEBUG_MALLOC
+                " DEBUG_MALLOC"
+#endif
+#ifdef MEMORY_POOLS
+                " MEMORY_POOLS"
+#endif
+#ifdef AVL_5XLINKED
+                " AVL_5XLINKED"
+#endif
+#ifdef NO_ASSERTIONS
+                " NO_ASSERTIONS"
+#endif
+                "\n", GIT_REV);
+        printf("# name\titems\tops\tns_per_op\n");
+
+        for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+                bench_avl(sizes[s], 0);
+                bench_avl(sizes[s], 1);
+                bench_avl(sizes[s], 2);
+        }
+
+        // list_head counts items in 16 bits:
+        for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]) && sizes[s] <= 10000; s++)
+                bench_list(sizes[s]);
+
+        // IID_T is 16 bits:
+        for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]) && sizes[s] <= 10000; s++)
+                bench_iid(sizes[s]);
+
+        for (s = 0; s < sizeof (meshes) / sizeof (meshes[0]); s++) {
+                bench_iid_neigh(meshes[s], 1);
+                bench_iid_neigh(meshes[s], 50);
+        }
+
+        bench_bits();
+        bench_metrics();
+
+        checkLeak();
+
+        return 0;
+}
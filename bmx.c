@@ -36,6 +36,7 @@
 #include "hna.h"
 #include "schedule.h"
 #include "tools.h"
+#include "hash.h"
 #include "metrics.h"
 #include "plugin.h"
 
@@ -58,6 +59,17 @@ int32_t my_ogm_interval = DEF_OGM_INTERVAL;   /* orginator message interval in m
 
 static int32_t link_purge_to = DEF_LINK_PURGE_TO;
 
+static int32_t status_worker = DEF_STATUS_WORKER;
+
+static int32_t status_snapshot_ival = DEF_STATUS_SNAPSHOT_IVAL;
+
+static int32_t integrity_budget = DEF_INTEGRITY_BUDGET;
+
+static IDM_T status_rows_task_active = NO;
+static IDM_T status_rows_active = NO;
+static struct status_handl *orig_status_handl = NULL;
+static struct status_handl *link_status_handl = NULL;
+
 
 IDM_T terminating = 0;
 IDM_T initializing = YES;
@@ -66,14 +78,15 @@ IDM_T cleaning_up = NO;
 const IDM_T CONST_YES = YES;
 const IDM_T CONST_NO = NO;
 
-static struct timeval start_time_tv;
-static struct timeval curr_tv;
+static struct timespec start_time_ts; // CLOCK_MONOTONIC
+static struct timeval curr_tv;        // wall clock, only for mapping kernel rx timestamps
 
 
 static RNG rng;
 
 TIME_T bmx_time = 0;
 TIME_SEC_T bmx_time_sec = 0;
+uint64_t bmx_time_us = 0;
 
 
 uint32_t s_curr_avg_cpu_load = 0;
@@ -95,11 +108,11 @@ AVL_TREE(link_tree, struct link_node, key);
 AVL_TREE(local_tree, struct local_node, local_id);
 AVL_TREE(neigh_tree, struct neigh_node, nnkey);
 
-AVL_TREE(dhash_tree, struct dhash_node, dhash);
+AVL_TREE_INTRUSIVE(dhash_tree, struct dhash_node, dhash, dhash_tree_an);
 AVL_TREE(dhash_invalid_tree, struct dhash_node, dhash);
 LIST_SIMPEL( dhash_invalid_plist, struct plist_node, list, list );
 
-AVL_TREE(orig_tree, struct orig_node, global_id);
+AVL_TREE_INTRUSIVE(orig_tree, struct orig_node, global_id, orig_tree_an);
 static AVL_TREE(blocked_tree, struct orig_node, global_id);
 
 AVL_TREE(blacklisted_tree, struct black_node, dhash);
@@ -187,6 +200,9 @@ struct dhash_node* create_dhash_node(struct description_hash *dhash, struct orig
         dhn->on = on;
         on->dhn = dhn;
 
+        // a pending ogm of on is now found via its new IID:
+        ogm_pending_mark(on);
+
         dbgf_track(DBGT_INFO, "dhash %8X.. myIID4orig %d", dhn->dhash.h.u32[0], dhn->myIID4orig);
 
         return dhn;
@@ -326,6 +342,8 @@ void free_neigh_node(struct neigh_node *neigh)
         avl_remove(&neigh_tree, &neigh->nnkey, -300196);
         iid_purge_repos(&neigh->neighIID4x_repos);
 
+        status_local_changed(neigh->local);
+
         neigh->dhn->neigh = NULL;
         neigh->dhn = NULL;
         neigh->local->neigh = NULL;
@@ -490,6 +508,8 @@ void purge_orig_router(struct orig_node *only_orig, struct link_dev_node *only_l
 
                         debugFree(rt, -300225);
 
+                        status_orig_changed(on);
+
 
                         if (only_lndev)
                                 break;
@@ -540,6 +560,7 @@ void purge_link_node(struct link_node_key *only_link_key, struct dev_node *only_
                                 purge_orig_router(NULL, lndev, NO);
 
                                 purge_tx_task_list(lndev->tx_task_lists, NULL, NULL);
+                                purge_tx_task_lndev(lndev);
 
                                 if (lndev->link_adv_msg != LINKADV_MSG_IGNORED)
                                         removed_link_adv = YES; // delay update_my_link_adv() until trees are clean again!
@@ -558,6 +579,8 @@ void purge_link_node(struct link_node_key *only_link_key, struct dev_node *only_
                                 avl_remove(&link_dev_tree, &lndev->key, -300221);
                                 debugFree(lndev, -300044);
 
+                                status_local_changed(local);
+
                         } else {
                                 prev = pos;
                         }
@@ -595,6 +618,8 @@ void purge_link_node(struct link_node_key *only_link_key, struct dev_node *only_
 
                                 assertion(-501135, (!local->orig_routes));
 
+                                status_local_removed(local);
+
                                 avl_remove(&local_tree, &link->key.local_id, -300331);
 
                                 debugFree(local, -300333);
@@ -653,6 +678,55 @@ void block_orig_node(IDM_T block, struct orig_node *on)
 
         }
 
+        status_orig_changed(on);
+
+}
+
+/*
+ * Originators and their useless routers are purged by per-originator tasks instead of periodic sweeps over
+ * my_iid_repos, so the scheduler heap orders them by deadline and only due ones are looked at.
+ * The expiry task is re-armed lazily: referred_by_me_timestamp is refreshed far more often than it expires,
+ * so it is only compared when the previously computed deadline is reached.
+ */
+STATIC_FUNC
+void orig_expiry_task(struct orig_node *on)
+{
+        TRACE_FUNCTION_CALL;
+        assertion(-501628, (on && on != self));
+
+        TIME_T referred = on->dhn ? (TIME_T) (bmx_time - on->dhn->referred_by_me_timestamp) : 0;
+
+        if (referred > (TIME_T) ogm_purge_to) {
+
+                dbgf_all(DBGT_INFO, "id=%s referred before: %d > purge_to=%d",
+                        globalIdAsString(&on->global_id), referred, (TIME_T) ogm_purge_to);
+
+                if (on->desc)
+                        cb_plugin_hooks(PLUGIN_CB_DESCRIPTION_DESTROY, on);
+
+                free_orig_node(on);
+
+        } else {
+
+                task_register(XMIN(((TIME_T) ogm_purge_to) - referred + 1, REGISTER_TASK_TIMEOUT_MAX),
+                        (void(*)(void*))orig_expiry_task, on, -300606);
+        }
+}
+
+STATIC_FUNC
+void orig_router_purge_task(struct orig_node *on)
+{
+        TRACE_FUNCTION_CALL;
+        assertion(-501629, (on));
+
+        purge_orig_router(on, NULL, YES /*only_useless*/);
+}
+
+// called whenever a router metric drops below UMETRIC_ROUTABLE, purges within ROUTER_PURGE_DELAY unless it recovers
+void schedule_orig_router_purge(struct orig_node *on)
+{
+        if (!task_registered((void(*)(void*))orig_router_purge_task, on))
+                task_register(ROUTER_PURGE_DELAY, (void(*)(void*))orig_router_purge_task, on, -300607);
 }
 
 void free_orig_node(struct orig_node *on)
@@ -665,6 +739,9 @@ void free_orig_node(struct orig_node *on)
 
         //cb_route_change_hooks(DEL, on, 0, &on->ort.rt_key.llip);
 
+        task_remove((void(*)(void*))orig_expiry_task, on);
+        task_remove((void(*)(void*))orig_router_purge_task, on);
+
         purge_orig_router(on, NULL, NO);
 
         if (on->desc && on->added) {
@@ -683,6 +760,8 @@ void free_orig_node(struct orig_node *on)
                 free_dhash_node(on->dhn);
         }
 
+        status_orig_removed(on);
+
         avl_remove(&orig_tree, &on->global_id, -300200);
         cb_plugin_hooks(PLUGIN_CB_STATUS, NULL);
 
@@ -897,6 +976,9 @@ struct link_node *get_link_node(struct packet_buff *pb)
         local->packet_link_sqn_ref = pb->i.link_sqn;
         local->packet_time = bmx_time;
 
+        // most link status fields are updated by the packets of this neighbor:
+        status_local_changed(local);
+
 
         if (!link) {
 
@@ -1123,9 +1205,9 @@ process_packet_error:
 
 
 #ifndef NO_TRACE_FUNCTION_CALLS
-static char* function_call_buffer_name_array[FUNCTION_CALL_BUFFER_SIZE] = {0};
-static TIME_T function_call_buffer_time_array[FUNCTION_CALL_BUFFER_SIZE] = {0};
-static uint8_t function_call_buffer_pos = 0;
+static __thread char* function_call_buffer_name_array[FUNCTION_CALL_BUFFER_SIZE] = {0};
+static __thread TIME_T function_call_buffer_time_array[FUNCTION_CALL_BUFFER_SIZE] = {0};
+static __thread uint8_t function_call_buffer_pos = 0;
 
 static void debug_function_calls(void)
 {
@@ -1155,47 +1237,56 @@ void trace_function_call(const char *func)
 
 void upd_time(struct timeval *precise_tv)
 {
-        static const struct timeval MAX_TV = {(((MAX_SELECT_TIMEOUT_MS + MAX_SELECT_SAFETY_MS) / 1000)), (((MAX_SELECT_TIMEOUT_MS + MAX_SELECT_SAFETY_MS) % 1000)*1000)};
-
-        struct timeval bmx_tv, diff_tv, acceptable_max_tv, acceptable_min_tv = curr_tv;
-
-        timeradd( &MAX_TV, &curr_tv, &acceptable_max_tv );
-
-	gettimeofday( &curr_tv, NULL );
+        struct timespec now;
 
-	if ( timercmp( &curr_tv, &acceptable_max_tv, > ) ) {
+        // monotonic, so wall clock adjustments can not disturb scheduling:
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        gettimeofday(&curr_tv, NULL);
 
-		timersub( &curr_tv, &acceptable_max_tv, &diff_tv );
-		timeradd( &start_time_tv, &diff_tv, &start_time_tv );
+        bmx_time_us = (((int64_t) (now.tv_sec - start_time_ts.tv_sec)) * 1000000) +
+                ((now.tv_nsec - start_time_ts.tv_nsec) / 1000);
 
-                dbg_sys(DBGT_WARN, "critical system time drift detected: ++ca %ld s, %ld us! Correcting reference!",
-		     diff_tv.tv_sec, diff_tv.tv_usec );
+	if ( precise_tv ) {
+		precise_tv->tv_sec = bmx_time_us / 1000000;
+		precise_tv->tv_usec = bmx_time_us % 1000000;
+	}
 
-                if ( diff_tv.tv_sec > CRITICAL_PURGE_TIME_DRIFT )
-                        purge_link_route_orig_nodes(NULL, NO);
+	bmx_time = bmx_time_us / 1000;
+	bmx_time_sec = bmx_time_us / 1000000;
+}
 
-	} else 	if ( timercmp( &curr_tv, &acceptable_min_tv, < ) ) {
+/*
+ * Returns the CLOCK_MONOTONIC time at which bmx_time reaches t (eg. for arming timerfds)
+ */
+void get_monotonic_time(TIME_T t, struct timespec *ts)
+{
+        // t is expected in the near future, bmx_time_us does not wrap around:
+        uint64_t nsec = start_time_ts.tv_nsec + ((bmx_time_us / 1000) + ((TIME_T) (t - bmx_time))) * 1000000;
 
-		timersub( &acceptable_min_tv, &curr_tv, &diff_tv );
-		timersub( &start_time_tv, &diff_tv, &start_time_tv );
+        ts->tv_sec = start_time_ts.tv_sec + (nsec / 1000000000);
+        ts->tv_nsec = nsec % 1000000000;
+}
 
-                dbg_sys(DBGT_WARN, "critical system time drift detected: --ca %ld s, %ld us! Correcting reference!",
-		     diff_tv.tv_sec, diff_tv.tv_usec );
+/*
+ * Maps a kernel receive timestamp (wall clock) into the bmx_time domain.
+ * Packets queued since before the last upd_time() get their real arrival time,
+ * missing or implausible stamps fall back to bmx_time.
+ */
+TIME_T get_rx_time(struct timespec *rx_stamp)
+{
+        struct timeval stamp_tv = {rx_stamp->tv_sec, rx_stamp->tv_nsec / 1000}, age_tv;
 
-                if ( diff_tv.tv_sec > CRITICAL_PURGE_TIME_DRIFT )
-                        purge_link_route_orig_nodes(NULL, NO);
+        if (!rx_stamp->tv_sec || timercmp(&stamp_tv, &curr_tv, >))
+                return bmx_time;
 
-	}
+        timersub(&curr_tv, &stamp_tv, &age_tv);
 
-	timersub( &curr_tv, &start_time_tv, &bmx_tv );
+        TIME_T age = (age_tv.tv_sec * 1000) + (age_tv.tv_usec / 1000);
 
-	if ( precise_tv ) {
-		precise_tv->tv_sec = bmx_tv.tv_sec;
-		precise_tv->tv_usec = bmx_tv.tv_usec;
-	}
+        if (age_tv.tv_sec >= MAX_SELECT_TIMEOUT_MS / 1000 || age > bmx_time)
+                return bmx_time;
 
-	bmx_time = ( (bmx_tv.tv_sec * 1000) + (bmx_tv.tv_usec / 1000) );
-	bmx_time_sec = bmx_tv.tv_sec;
+        return bmx_time - age;
 }
 
 char *get_human_uptime(uint32_t reference)
@@ -1332,8 +1423,14 @@ void cleanup_all(int32_t status)
                         self = NULL;
                 }
 
+                ctrl_worker_stop();
+
+                status_rows_enable(NO);
+
                 while (status_tree.items) {
                         struct status_handl *handl = avl_remove_first_item(&status_tree, -300357);
+                        if (handl->snapshot)
+                                debugFree(handl->snapshot, -300589);
                         if (handl->data)
                                 debugFree(handl->data, -300359);
                         debugFree(handl, -300363);
@@ -1442,7 +1539,7 @@ char *field_dbg_value(const struct field_format *format, uint16_t min_msg_size,
 
                 if (bits <= 32) {
 
-                        static char uint32_out[ 16 ] = {0};
+                        static __thread char uint32_out[ 16 ] = {0};
 
                         int64_t field_val = field_get_value(format, min_msg_size, data, pos_bit, bits);
 
@@ -1670,11 +1767,12 @@ uint32_t fields_dbg_lines(struct ctrl_node *cn, uint16_t relevance, uint16_t dat
         return msgs_size;
 }
 
-void fields_dbg_table(struct ctrl_node *cn, uint16_t relevance, uint32_t data_size, uint8_t *data,
+// returns the rendered table in a malloc()ed string (also called by the ctrl worker thread, so no debugMalloc())
+char *fields_dbg_table_str(uint16_t relevance, uint32_t data_size, uint8_t *data,
                           uint16_t min_msg_size, const struct field_format *format)
 {
         TRACE_FUNCTION_CALL;
-        assertion(-501255, (format && data && cn));
+        assertion(-501255, (format && data));
 
         uint16_t field_string_sizes[FIELD_FORMAT_MAX_ITEMS] = {0};
         uint32_t columns = field_format_get_items(format);
@@ -1706,7 +1804,11 @@ void fields_dbg_table(struct ctrl_node *cn, uint16_t relevance, uint32_t data_si
                 }
         }
 
-        char * out = debugMalloc(((rows * bytes_per_row) + 1), -300383);
+        char * out = malloc(((rows * bytes_per_row) + 1));
+
+        if (!out)
+                return NULL;
+
         memset(out, ' ', (rows * bytes_per_row));
 
         uint32_t i = 0, pos = 0;
@@ -1749,8 +1851,20 @@ void fields_dbg_table(struct ctrl_node *cn, uint16_t relevance, uint32_t data_si
                 }
         }
         out[pos++] = '\0';
-        dbg_printf(cn, "%s", out);
-        debugFree(out, -300384);
+        return out;
+}
+
+void fields_dbg_table(struct ctrl_node *cn, uint16_t relevance, uint32_t data_size, uint8_t *data,
+                          uint16_t min_msg_size, const struct field_format *format)
+{
+        assertion(-501586, (cn));
+
+        char *out = fields_dbg_table_str(relevance, data_size, data, min_msg_size, format);
+
+        if (out) {
+                dbg_printf(cn, "%s", out);
+                free(out);
+        }
 }
 
 
@@ -1772,6 +1886,318 @@ void register_status_handl(uint16_t min_msg_size, IDM_T multiline, const struct
 
 
 
+#define STATUS_SNAPSHOT_ALIGN(len) (((len) + 7) & ~((uint32_t) 7))
+
+// returns the space needed by the targets of all pointer fields and, given an arena, moves them there:
+STATIC_FUNC
+uint32_t status_snapshot_flatten(const struct field_format *format, uint16_t min_msg_size, uint32_t data_len, uint8_t *data, uint8_t *arena)
+{
+        uint32_t arena_len = 0;
+        struct field_iterator it = {.format = format, .data = data, .data_size = data_len, .min_msg_size = min_msg_size};
+
+        while (field_iterate(&it) == SUCCESS) {
+
+                uint8_t field_type = format[it.field].field_type;
+                void **pp = (void**) (data + (it.field_bit_pos / 8));
+                uint32_t size;
+
+                if (field_type == FIELD_TYPE_POINTER_CHAR)
+                        size = *pp ? strlen(*((char**) pp)) + 1 : 0;
+                else if (field_type == FIELD_TYPE_POINTER_GLOBAL_ID)
+                        size = sizeof (GLOBAL_ID_T);
+                else if (field_type == FIELD_TYPE_POINTER_UMETRIC)
+                        size = sizeof (UMETRIC_T);
+                else if (field_type == FIELD_TYPE_IPX6P)
+                        size = sizeof (IPX_T);
+                else if (field_type == FIELD_TYPE_NETP)
+                        size = sizeof (struct net_key);
+                else
+                        continue;
+
+                if (!*pp)
+                        continue;
+
+                if (arena) {
+                        memcpy(arena + arena_len, *pp, size);
+                        *pp = arena + arena_len;
+                }
+
+                arena_len += STATUS_SNAPSHOT_ALIGN(size);
+        }
+
+        return arena_len;
+}
+
+STATIC_FUNC
+void status_snapshot_retire(struct status_handl *handl)
+{
+        struct status_snapshot *ss = handl->snapshot;
+
+        if (!ss)
+                return;
+
+        handl->snapshot = NULL;
+        ss->retired = YES;
+
+        if (!ss->users)
+                debugFree(ss, -300589);
+}
+
+void status_snapshot_release(struct status_snapshot *ss)
+{
+        assertion(-501587, (ss->users));
+
+        if (!(--ss->users) && ss->retired)
+                debugFree(ss, -300589);
+}
+
+STATIC_FUNC
+void status_rows_render(struct status_handl *handl, struct status_rows *sr)
+{
+        TRACE_FUNCTION_CALL;
+
+        uint32_t rows_len = (*(handl->frame_creator))(handl, sr->obj);
+        uint32_t arena_len = rows_len ?
+                status_snapshot_flatten(handl->format, handl->min_msg_size, rows_len, handl->data, NULL) : 0;
+
+        if (sr->data)
+                debugFree(sr->data, -300614);
+
+        sr->data = rows_len ? debugMalloc(STATUS_SNAPSHOT_ALIGN(rows_len) + arena_len, -300614) : NULL;
+        sr->rows_len = rows_len;
+        sr->arena_len = arena_len;
+        sr->rendered = bmx_time;
+
+        if (rows_len) {
+                memcpy(sr->data, handl->data, rows_len);
+                status_snapshot_flatten(handl->format, handl->min_msg_size, rows_len, sr->data, sr->data + STATUS_SNAPSHOT_ALIGN(rows_len));
+        }
+
+        handl->rows_changed = YES;
+}
+
+/*
+ * Re-renders the rows of objects changed since the last run. Costs follow the rate of changes,
+ * not the table size, and objects changed several times in between are rendered only once.
+ */
+STATIC_FUNC
+void status_rows_task(void *unused)
+{
+        TRACE_FUNCTION_CALL;
+
+        struct avl_node *an = NULL;
+        struct status_handl *handl;
+        struct status_rows *sr;
+        uint32_t rendered = 0;
+
+        ctrl_worker_reap();
+
+        status_rows_task_active = NO;
+
+        while ((handl = avl_iterate_item(&status_tree, &an))) {
+
+                while ((sr = avl_first_item(&handl->rows_dirty))) {
+
+                        if (rendered++ >= STATUS_ROWS_RENDER_MAX) {
+                                // let packets be processed before rendering the remaining ones:
+                                status_rows_task_active = YES;
+                                task_register(1, status_rows_task, NULL, -300590);
+                                return;
+                        }
+
+                        avl_remove(&handl->rows_dirty, sr->key, -300616);
+                        sr->dirty = NO;
+                        status_rows_render(handl, sr);
+                }
+        }
+}
+
+STATIC_FUNC
+void status_rows_changed(struct status_handl *handl, void *obj, void *key)
+{
+        struct status_rows *sr = avl_find_item(&handl->rows, key);
+
+        if (!sr) {
+                sr = debugMallocReset(sizeof (struct status_rows), -300613);
+                memcpy(sr->key, key, handl->rows.key_size);
+                avl_insert(&handl->rows, sr, -300615);
+        }
+
+        sr->obj = obj;
+
+        if (!sr->dirty) {
+                sr->dirty = YES;
+                avl_insert(&handl->rows_dirty, sr, -300616);
+        }
+
+        if (!status_rows_task_active) {
+                status_rows_task_active = YES;
+                task_register(status_snapshot_ival, status_rows_task, NULL, -300590);
+        }
+}
+
+STATIC_FUNC
+void status_rows_removed(struct status_handl *handl, void *key)
+{
+        struct status_rows *sr = avl_remove(&handl->rows, key, -300615);
+
+        if (!sr)
+                return;
+
+        if (sr->dirty)
+                avl_remove(&handl->rows_dirty, key, -300616);
+
+        if (sr->data)
+                debugFree(sr->data, -300614);
+
+        debugFree(sr, -300613);
+
+        handl->rows_changed = YES;
+}
+
+void status_orig_changed(struct orig_node *on)
+{
+        if (status_rows_active && on)
+                status_rows_changed(orig_status_handl, on, &on->global_id);
+}
+
+void status_orig_removed(struct orig_node *on)
+{
+        if (status_rows_active)
+                status_rows_removed(orig_status_handl, &on->global_id);
+}
+
+void status_local_changed(struct local_node *local)
+{
+        if (status_rows_active && local)
+                status_rows_changed(link_status_handl, local, &local->local_id);
+}
+
+void status_local_removed(struct local_node *local)
+{
+        if (status_rows_active)
+                status_rows_removed(link_status_handl, &local->local_id);
+}
+
+// (re-)marks all rows when enabled, so that later on only changes must be tracked:
+void status_rows_enable(IDM_T enable)
+{
+        struct avl_node *an = NULL;
+        struct status_handl *handl;
+        struct orig_node *on;
+        struct local_node *local;
+
+        if (enable == status_rows_active)
+                return;
+
+        while ((handl = avl_iterate_item(&status_tree, &an))) {
+
+                struct status_rows *sr;
+
+                while ((sr = avl_first_item(&handl->rows)))
+                        status_rows_removed(handl, sr->key);
+
+                status_snapshot_retire(handl);
+        }
+
+        if (!(status_rows_active = enable))
+                return;
+
+        for (an = NULL; (on = avl_iterate_item(&orig_tree, &an));)
+                status_orig_changed(on);
+
+        for (an = NULL; (local = avl_iterate_item(&local_tree, &an));)
+                status_local_changed(local);
+}
+
+STATIC_FUNC
+void register_status_rows(char *name, uint16_t key_size, void (*aged) (uint8_t *data, uint32_t rows_len, TIME_T age))
+{
+        char status_name[sizeof (((struct status_handl *) NULL)->status_name)] = {0};
+        struct status_handl *handl;
+
+        strncpy(status_name, name, sizeof (status_name));
+        handl = avl_find_item(&status_tree, status_name);
+
+        assertion(-501643, (handl && key_size <= sizeof (((struct status_rows *) NULL)->key)));
+
+        AVL_INIT_TREE(handl->rows, struct status_rows, key);
+        AVL_INIT_TREE(handl->rows_dirty, struct status_rows, key);
+        handl->rows.key_size = handl->rows_dirty.key_size = key_size;
+        handl->rows_aged = aged;
+
+        if (!strcmp(name, ARG_ORIGINATORS))
+                orig_status_handl = handl;
+        else if (!strcmp(name, ARG_LINKS))
+                link_status_handl = handl;
+}
+
+// copies the current rows into a self-contained snapshot, without calling the table creator:
+STATIC_FUNC
+void status_snapshot_assemble(struct status_handl *handl)
+{
+        TRACE_FUNCTION_CALL;
+
+        struct avl_node *an = NULL;
+        struct status_rows *sr;
+        uint32_t data_len = 0, arena_len = 0, pos = 0;
+
+        while ((sr = avl_iterate_item(&handl->rows, &an))) {
+                data_len += sr->rows_len;
+                arena_len += sr->arena_len;
+        }
+
+        struct status_snapshot *ss =
+                debugMalloc(sizeof (struct status_snapshot) + STATUS_SNAPSHOT_ALIGN(data_len) + arena_len, -300588);
+
+        memset(ss, 0, sizeof (struct status_snapshot));
+        strcpy(ss->status_name, handl->status_name);
+        ss->format = handl->format;
+        ss->min_msg_size = handl->min_msg_size;
+        ss->data_len = data_len;
+        ss->created = bmx_time;
+
+        for (an = NULL; (sr = avl_iterate_item(&handl->rows, &an));) {
+
+                if (!sr->rows_len)
+                        continue;
+
+                memcpy(ss->data + pos, sr->data, sr->rows_len);
+
+                if (handl->rows_aged)
+                        (*(handl->rows_aged))(ss->data + pos, sr->rows_len, bmx_time - sr->rendered);
+
+                pos += sr->rows_len;
+        }
+
+        // the pointer fields still refer to the arenas of the rows:
+        if (data_len)
+                status_snapshot_flatten(ss->format, ss->min_msg_size, data_len, ss->data, ss->data + STATUS_SNAPSHOT_ALIGN(data_len));
+
+        status_snapshot_retire(handl);
+        handl->snapshot = ss;
+        handl->rows_changed = NO;
+}
+
+/*
+ * Tables with incrementally maintained rows are handed to the ctrl worker thread as snapshot.
+ * Others are small and still created and served synchronously by the caller.
+ */
+STATIC_FUNC
+IDM_T status_snapshot_serve(struct status_handl *handl, struct ctrl_node *cn, uint16_t relevance)
+{
+        if (!status_rows_active || !handl->rows.key_size ||
+                terminating || !cn || cn->fd <= 0 || cn->fd == STDOUT_FILENO || cn->cn_fd_handler)
+                return FAILURE;
+
+        // relative time fields have a resolution of seconds:
+        if (!handl->snapshot || handl->rows_changed || ((TIME_T) (bmx_time - handl->snapshot->created)) >= 1000)
+                status_snapshot_assemble(handl);
+
+        return ctrl_worker_status(cn, handl->snapshot, relevance);
+}
+
+
 
 struct bmx_status {
         char version[(sizeof(BMX_BRANCH)-1) + (sizeof("-")-1) + (sizeof(BRANCH_VERSION)-1) + 1];
@@ -1885,18 +2311,22 @@ static const struct field_format link_status_format[] = {
         FIELD_FORMAT_END
 };
 
+// creates the rows of all links or, given data, only those of the local_node data
 static int32_t link_status_creator(struct status_handl *handl, void *data)
 {
-        struct avl_node *link_it, *local_it;
+        struct avl_node *link_it, *local_it = NULL;
         struct link_node *link;
         struct local_node *local;
         uint32_t max_size = link_dev_tree.items * sizeof (struct link_status);
         uint32_t i = 0;
 
+        if (!max_size)
+                return 0;
+
         struct link_status *status = ((struct link_status*) (handl->data = debugRealloc(handl->data, max_size, -300358)));
         memset(status, 0, max_size);
 
-        for (local_it = NULL; (local = avl_iterate_item(&local_tree, &local_it));) {
+        while (data ? (local = data) : (local = avl_iterate_item(&local_tree, &local_it))) {
 
                 struct orig_node *on = local->neigh ? local->neigh->dhn->on : NULL;
 
@@ -1934,11 +2364,26 @@ static int32_t link_status_creator(struct status_handl *handl, void *data)
                                 assertion(-501225, (max_size >= i * sizeof (struct link_status)));
                         }
                 }
+
+                if (data)
+                        break;
         }
 
         return i * sizeof (struct link_status);
 }
 
+STATIC_FUNC
+void link_status_aged(uint8_t *data, uint32_t rows_len, TIME_T age)
+{
+        struct link_status *status = (struct link_status *) data;
+        uint32_t i;
+
+        for (i = 0; i < rows_len / sizeof (struct link_status); i++) {
+                status[i].lastHelloAdv += age / 1000;
+                status[i].lastLinkAdv += age / 1000;
+        }
+}
+
 
 
 
@@ -2009,6 +2454,18 @@ static int32_t orig_status_creator(struct status_handl *handl, void *data)
         return status_size;
 }
 
+STATIC_FUNC
+void orig_status_aged(uint8_t *data, uint32_t rows_len, TIME_T age)
+{
+        struct orig_status *status = (struct orig_status *) data;
+        uint32_t i;
+
+        for (i = 0; i < rows_len / sizeof (struct orig_status); i++) {
+                status[i].lastDesc += age / 1000;
+                status[i].lastRef += age / 1000;
+        }
+}
+
 
 STATIC_FUNC
 int32_t opt_version(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
@@ -2029,6 +2486,15 @@ int32_t opt_version(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt
         return SUCCESS;
  }
 
+STATIC_FUNC
+int32_t opt_status_worker(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
+{
+        if (cmd == OPT_APPLY)
+                status_rows_enable(status_worker);
+
+        return SUCCESS;
+}
+
 int32_t opt_status(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
 {
         TRACE_FUNCTION_CALL;
@@ -2057,7 +2523,11 @@ int32_t opt_status(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_
 
                 if ((handl = avl_find_item(&status_tree, status_name))) {
 
-                        if (cmd == OPT_APPLY && (data_len = ((*(handl->frame_creator))(handl, NULL)))) {
+                        if (cmd == OPT_APPLY && status_snapshot_serve(handl, cn, relevance) == SUCCESS) {
+
+                                return SUCCESS;
+
+                        } else if (cmd == OPT_APPLY && (data_len = ((*(handl->frame_creator))(handl, NULL)))) {
                                 dbg_printf(cn, "%s:\n", handl->status_name);
 				dbgf_track(DBGT_INFO, "name=%10s %6d / %6d = %6d %% %6d",
 					handl->status_name, data_len, handl->min_msg_size, (data_len / handl->min_msg_size), (data_len % handl->min_msg_size));
@@ -2080,6 +2550,28 @@ int32_t opt_status(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_
 }
 
 
+#if defined DEBUG_MALLOC && defined MALLOC_TEST
+static int32_t malloc_bench_chunks = 10000;
+static int32_t malloc_churn_objects = 100000;
+
+STATIC_FUNC
+int32_t opt_malloc_bench(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
+{
+
+	if ( cmd == OPT_APPLY ) {
+
+		if (!strcmp(opt->name, "mallocChurn"))
+			debugMallocChurn(malloc_churn_objects);
+		else
+			debugMallocBench(malloc_bench_chunks);
+
+		cleanup_all(CLEANUP_SUCCESS);
+	}
+
+	return SUCCESS;
+}
+#endif
+
 STATIC_FUNC
 int32_t opt_purge(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
 {
@@ -2126,6 +2618,12 @@ static struct opt_type bmx_options[]=
 	{ODI,0,ARG_ORIGINATORS,	        0,  9,2,A_PS0N,A_USR,A_DYN,A_ARG,A_ANY,	0,		0, 		0,		0,0, 		opt_status,
 			0,		"show originators\n"}
         ,
+	{ODI,0,ARG_STATUS_WORKER,	0,  9,1,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&status_worker,	MIN_STATUS_WORKER,MAX_STATUS_WORKER,DEF_STATUS_WORKER,0,opt_status_worker,
+			ARG_VALUE_FORM,	"serve status requests of unix clients from snapshots rendered by a separate worker thread"}
+        ,
+	{ODI,0,ARG_STATUS_SNAPSHOT_IVAL,0,  9,1,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&status_snapshot_ival,MIN_STATUS_SNAPSHOT_IVAL,MAX_STATUS_SNAPSHOT_IVAL,DEF_STATUS_SNAPSHOT_IVAL,0,0,
+			ARG_VALUE_FORM,	"delay in ms with which changed rows of status snapshots are re-rendered"}
+        ,
 	{ODI,0,ARG_TTL,			't',9,0,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&my_ttl,	MIN_TTL,	MAX_TTL,	DEF_TTL,0,	opt_update_description,
 			ARG_VALUE_FORM,	"set time-to-live (TTL) for OGMs"}
         ,
@@ -2152,6 +2650,18 @@ static struct opt_type bmx_options[]=
         ,
 	{ODI,0,ARG_DROP_ALL_PACKETS,     0, 9,0,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&drop_all_packets,	MIN_DROP_ALL_PACKETS,	MAX_DROP_ALL_PACKETS,	DEF_DROP_ALL_PACKETS,0,	0,
 			ARG_VALUE_FORM,	"drop all received packets"}
+#ifdef DEBUG_MALLOC
+        ,
+	{ODI,0,ARG_INTEGRITY_BUDGET,	0,  9,1,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&integrity_budget,MIN_INTEGRITY_BUDGET,MAX_INTEGRITY_BUDGET,DEF_INTEGRITY_BUDGET,0,0,
+			ARG_VALUE_FORM,	"set time in us per main-loop iteration for incremental heap integrity checks (0 checks the whole heap every 5 s)"}
+#endif
+#if defined DEBUG_MALLOC && defined MALLOC_TEST
+        ,
+	{ODI,0,"mallocBench",  	        0, 9,0,A_PS1,A_ADM,A_INI,A_ARG,A_ANY,	&malloc_bench_chunks,	1,	1000000,	10000,0,	opt_malloc_bench,
+			ARG_VALUE_FORM,	"benchmark debugFree() against the former chunk list walk with given number of chunks"},
+	{ODI,0,"mallocChurn",  	        0, 9,0,A_PS1,A_ADM,A_INI,A_ARG,A_ANY,	&malloc_churn_objects,	1,	10000000,	100000,0,	opt_malloc_bench,
+			ARG_VALUE_FORM,	"benchmark allocation rate and RSS of slab pools against malloc() under churn of given number of live objects"}
+#endif
 
 };
 
@@ -2162,8 +2672,8 @@ char *globalIdAsString( struct GLOBAL_ID *id ) {
         if ( id ) {
                 uint8_t i;
 #define MAX_IDS_PER_PRINTF 4
-                static char id_str[MAX_IDS_PER_PRINTF][GLOBAL_ID_NAME_LEN + (sizeof(".")-1) + (GLOBAL_ID_PKID_LEN * 2) + 1];
-                static uint8_t a = 0;
+                static __thread char id_str[MAX_IDS_PER_PRINTF][GLOBAL_ID_NAME_LEN + (sizeof(".")-1) + (GLOBAL_ID_PKID_LEN * 2) + 1];
+                static __thread uint8_t a = 0;
 
                 a = (a + 1) % MAX_IDS_PER_PRINTF;
 
@@ -2191,6 +2701,12 @@ struct orig_node *init_orig_node(GLOBAL_ID_T *id)
 
         avl_insert(&orig_tree, on, -300148);
 
+        status_orig_changed(on);
+
+        // self is still NULL while creating self, which never expires:
+        if (self)
+                task_register(XMIN((TIME_T) ogm_purge_to + 1, REGISTER_TASK_TIMEOUT_MAX), (void(*)(void*))orig_expiry_task, on, -300606);
+
         cb_plugin_hooks(PLUGIN_CB_STATUS, NULL);
 
         return on;
@@ -2205,6 +2721,12 @@ void init_bmx(void)
         static GLOBAL_ID_T id;
         memset(&id, 0, sizeof (id));
 
+        // exact-match lookups per received packet, hash, and description:
+        avl_hash_index(&dhash_tree, HASH_KEY_RANDOM);
+        avl_hash_index(&orig_tree, HASH_KEY_MIXED);
+        avl_hash_index(&local_tree, HASH_KEY_MIXED);
+        avl_hash_index(&link_tree, HASH_KEY_MIXED);
+
         if (gethostname(id.name, GLOBAL_ID_NAME_LEN))
                 cleanup_all(-500240);
 
@@ -2232,6 +2754,13 @@ void init_bmx(void)
         register_status_handl(sizeof (struct link_status), 1, link_status_format, ARG_LINKS, link_status_creator);
         //register_status_handl(sizeof (struct local_status), local_status_format, ARG_LOCALS, locals_status_creator);
         register_status_handl(sizeof (struct orig_status), 1, orig_status_format, ARG_ORIGINATORS, orig_status_creator);
+
+        register_status_rows(ARG_LINKS, sizeof (LOCAL_ID_T), link_status_aged);
+        register_status_rows(ARG_ORIGINATORS, sizeof (GLOBAL_ID_T), orig_status_aged);
+        status_rows_enable(status_worker);
+
+        init_memory_usage();
+        init_integrity_check();
 }
 
 
@@ -2266,6 +2795,9 @@ void bmx(void)
 		if ( wait )
 			wait4Event( XMIN( wait, MAX_SELECT_TIMEOUT_MS ) );
 
+		if ( integrity_budget )
+			checkIntegritySlice( integrity_budget );
+
                 if (my_description_changed)
                         update_my_description_adv();
 
@@ -2310,7 +2842,7 @@ void bmx(void)
                         GLOBAL_ID_T id;
                         memset(&id, 0, sizeof (GLOBAL_ID_T));
 
-                        purge_link_route_orig_nodes(NULL, YES);
+                        purge_link_node(NULL, NULL, YES);
 
                         purge_dhash_invalid_list(NO);
 
@@ -2341,8 +2873,14 @@ void bmx(void)
 
                         }
 
-			// check for corrupted memory..
-			checkIntegrity();
+			// check for corrupted memory if not done incrementally..
+			if ( !integrity_budget )
+				checkIntegrity();
+
+#if defined(DEBUG_ALL) || defined(EXTREME_PARANOIA)
+			// full scan of all secondary indexes against their trees:
+			avl_index_check();
+#endif
 
 
 			/* generating cpu load statistics... */
@@ -2367,8 +2905,7 @@ int main(int argc, char *argv[])
         assertion(-500999, (sizeof(struct frame_header_long) == 4));
 
 
-	gettimeofday( &start_time_tv, NULL );
-        curr_tv = start_time_tv;
+	clock_gettime( CLOCK_MONOTONIC, &start_time_ts );
 
 	upd_time( NULL );
 
@@ -2401,7 +2938,7 @@ int main(int argc, char *argv[])
 	init_bmx();
         init_ip();
 
-	//init_schedule();
+	init_schedule();
 
         if (init_plugin() == SUCCESS) {
 
@@ -259,6 +259,8 @@ extern int32_t my_ogm_interval;
 #define MAX_OGM_PURGE_TO  864000000 /*10 days*/
 #define DEF_OGM_PURGE_TO  100000
 #define ARG_OGM_PURGE_TO  "purgeTimeout"
+
+#define ROUTER_PURGE_DELAY 5000 // like the former 5-second sweeps, a useless router may still recover meanwhile
 // extern int32_t purge_to;
 
 #define DEF_DAD_TO 20000//(MAX_OGM_INTERVAL + MAX_TX_INTERVAL)
@@ -563,6 +565,24 @@ extern int32_t my_ttl;
 #define ARG_ORIGINATORS "originators"
 #define ARG_STATUS "status"
 #define ARG_LINKS "links"
+#define ARG_MEMORY "memory"
+#define ARG_INTEGRITY "integrity"
+
+#define ARG_INTEGRITY_BUDGET "integrityCheckBudget"
+#define DEF_INTEGRITY_BUDGET 200
+#define MIN_INTEGRITY_BUDGET 0
+#define MAX_INTEGRITY_BUDGET 1000000
+
+#define ARG_STATUS_WORKER "statusWorker"
+#define DEF_STATUS_WORKER 0
+#define MIN_STATUS_WORKER 0
+#define MAX_STATUS_WORKER 1
+
+#define ARG_STATUS_SNAPSHOT_IVAL "statusSnapshotInterval"
+#define DEF_STATUS_SNAPSHOT_IVAL 1000
+#define MIN_STATUS_SNAPSHOT_IVAL 10
+#define MAX_STATUS_SNAPSHOT_IVAL 100000
+#define STATUS_ROWS_RENDER_MAX 256 // changed objects re-rendered per run of status_rows_task()
 
 #define ARG_THROW "throw"
 
@@ -596,7 +616,6 @@ enum ADGSN {
 
 #define MAX_SELECT_TIMEOUT_MS 1100 /* MUST be smaller than (1000/2) to fit into max tv_usec */
 #define MAX_SELECT_SAFETY_MS 200 /* MUST be smaller than (1000/2) to fit into max tv_usec */
-#define CRITICAL_PURGE_TIME_DRIFT 20
 
 
 #define XMAX( a, b ) ( (a>b) ? (a) : (b) )
@@ -639,6 +658,7 @@ enum ADGSN {
 
 extern TIME_T bmx_time;
 extern TIME_SEC_T bmx_time_sec;
+extern uint64_t bmx_time_us;
 
 extern IDM_T initializing;
 extern IDM_T terminating;
@@ -735,6 +755,29 @@ struct field_iterator {
 
 };
 
+// immutable, self-contained copy of a status table as served to unix clients by the ctrl worker:
+struct status_snapshot {
+        char status_name[16];
+        const struct field_format *format;
+        uint16_t min_msg_size;
+        IDM_T retired;  // replaced by a newer snapshot, freed once users drop to zero
+        uint32_t users; // pending ctrl worker jobs
+        uint32_t data_len;
+        TIME_T created;
+        uint8_t data[]; // data_len bytes table followed by the targets of all pointer fields
+};
+
+// rendered status table rows of one object (eg. all links of a neighbor), copied into snapshots when served:
+struct status_rows {
+        uint8_t key[sizeof (GLOBAL_ID_T)]; // orders the rows like the table, only status_handl.rows.key_size bytes are used
+        void *obj;
+        IDM_T dirty;
+        TIME_T rendered;   // relative time fields are aged by the time passed until they are served
+        uint32_t rows_len;  // table rows in data, followed by
+        uint32_t arena_len; // the targets of their pointer fields
+        uint8_t *data;
+};
+
 struct status_handl {
         uint16_t min_msg_size;
         IDM_T multiline;
@@ -744,6 +787,14 @@ struct status_handl {
 	int32_t (*frame_creator) (struct status_handl *status_handl, void *data);
 
 	const struct field_format *format;
+
+        struct status_snapshot *snapshot;
+
+        // only for tables maintained incrementally by status_rows_changed() and served from snapshots:
+        void (*rows_aged) (uint8_t *data, uint32_t rows_len, TIME_T age);
+        struct avl_tree rows;       // struct status_rows by key
+        struct avl_tree rows_dirty; // rows to be re-rendered by status_rows_task()
+        IDM_T rows_changed;         // since handl->snapshot has been assembled
 };
 
 extern struct avl_tree status_tree;
@@ -755,6 +806,11 @@ int64_t field_get_value(const struct field_format *format, uint16_t min_msg_size
 
 char *field_dbg_value(const struct field_format *format, uint16_t min_msg_size, uint8_t *data, uint32_t pos_bit, uint32_t bits);
 
+char *fields_dbg_table_str(uint16_t relevance, uint32_t data_size, uint8_t *data,
+                           uint16_t min_msg_size, const struct field_format *format);
+
+void status_snapshot_release(struct status_snapshot *ss);
+
 uint32_t fields_dbg_lines(struct ctrl_node *cn, uint16_t relevance, uint16_t data_size, uint8_t *data,
                     uint16_t min_msg_size,  const struct field_format *format);
 
@@ -764,11 +820,17 @@ uint32_t field_iterate(struct field_iterator *it);
 void register_status_handl(uint16_t min_msg_size, IDM_T multiline, const struct field_format* format, char *name,
                             int32_t(*creator) (struct status_handl *status_handl, void *data));
 
-struct task_node {
-	struct list_node list;
-	TIME_T expire;
+struct task_key {
 	void (* task) (void *fpara); // pointer to the function to be executed
 	void *data; //NULL or pointer to data to be given to function. Data will be freed after functio is called.
+} __attribute__((packed));
+
+struct task_node {
+	struct task_key key;
+	TIME_T expire;
+	uint32_t sqn;      // registration order, breaks ties between equal expire times
+	uint32_t heap_pos; // current index in the task heap
+	const char *name;  // as given to task_register(), for profiling
 };
 
 struct tx_task_content {
@@ -885,6 +947,8 @@ struct link_dev_node {
 	UMETRIC_T timeaware_rx_probe;
 
 	struct list_head tx_task_lists[FRAME_TYPE_ARRSZ]; // scheduled frames and messages
+	struct list_node tx_task_lndev_nodes[FRAME_TYPE_ARRSZ]; // membership in key.dev->tx_task_lndevs[]
+	uint32_t tx_task_lndevs_listed; // one bit per frame type, set while linked into key.dev->tx_task_lndevs[]
 	int16_t link_adv_msg;
 	TIME_T pkt_time_max;
 };
@@ -934,6 +998,7 @@ struct orig_node {
 	// filled in by validate_new_link_desc0():
 
 	GLOBAL_ID_T global_id;
+	struct avl_node orig_tree_an; // embedded node of orig_tree, next to its key
 
 	struct dhash_node *dhn;
 	struct description *desc;
@@ -989,6 +1054,7 @@ extern struct avl_tree dhash_invalid_tree;
 struct dhash_node {
 
 	struct description_hash dhash;
+	struct avl_node dhash_tree_an; // embedded node of dhash_tree, next to its key
 
 	TIME_T referred_by_me_timestamp; // last time this dhn was referred
 
@@ -1043,7 +1109,7 @@ struct packet_buff {
 	struct packet_buff_info {
 		//filled by wait4Event()
 		struct sockaddr_storage addr;
-		struct timeval tv_stamp;
+		struct timespec tv_stamp;
 		struct dev_node *iif;
 		int total_length;
 		uint8_t unicast;
@@ -1098,10 +1164,18 @@ IDM_T blacklisted_neighbor(struct packet_buff *pb, struct description_hash *dhas
 struct neigh_node *is_described_neigh( struct link_node *link, IID_T transmittersIID4x );
 
 void purge_link_route_orig_nodes(struct dev_node *only_dev, IDM_T only_expired);
+void schedule_orig_router_purge(struct orig_node *on);
 void block_orig_node(IDM_T block, struct orig_node *on);
 void free_orig_node(struct orig_node *on);
+
 struct orig_node * init_orig_node(GLOBAL_ID_T *id);
 
+void status_orig_changed(struct orig_node *on);
+void status_orig_removed(struct orig_node *on);
+void status_local_changed(struct local_node *local);
+void status_local_removed(struct local_node *local);
+void status_rows_enable(IDM_T enable);
+
 void purge_local_node(struct local_node *local);
 
 IDM_T update_local_neigh(struct packet_buff *pb, struct dhash_node *dhn);
@@ -1131,7 +1205,7 @@ void rx_packet( struct packet_buff *pb );
 /*
  * ASSERTION / PARANOIA ERROR CODES:
  * Negative numbers are used as SIGSEV error codes !
- * Currently used numbers are: -500000 -500001 ... -501578
+ * Currently used numbers are: -500000 -500001 ... -501645
  */
 
 //#define paranoia( code , problem ) do { if ( (problem) ) { cleanup_all( code ); } }while(0)
@@ -1201,6 +1275,8 @@ void wait_sec_usec(TIME_SEC_T sec, TIME_T usec);
 void cleanup_all( int32_t status );
 
 void upd_time( struct timeval *precise_tv );
+TIME_T get_rx_time( struct timespec *rx_stamp );
+void get_monotonic_time( TIME_T t, struct timespec *ts );
 
 char *get_human_uptime( uint32_t reference );
 
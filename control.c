@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <paths.h>
+#include <pthread.h>
 
 #include "bmx.h"
 #include "ip.h"
@@ -253,6 +254,236 @@ struct ctrl_node *create_ctrl_node(int fd, void (*cn_fd_handler) (struct ctrl_no
 	return cn;
 }
 
+
+
+/***********************************************************
+ ctrl worker: renders status snapshots and writes them (and all further
+ output that follows them) to unix clients off the routing thread
+************************************************************/
+
+#define CTRL_JOB_TEXT   1
+#define CTRL_JOB_STATUS 2
+#define CTRL_JOB_CLOSE  3
+
+struct ctrl_job {
+        struct list_node list;
+        uint8_t type;
+        uint8_t end; // CTRL_JOB_CLOSE: write CONNECTION_END_STR before closing
+        uint16_t relevance;
+        int fd;
+        struct status_snapshot *snapshot;
+        uint32_t len;
+        char text[];
+};
+
+static LIST_SIMPEL(ctrl_job_queue, struct ctrl_job, list, list);
+static LIST_SIMPEL(ctrl_job_done, struct ctrl_job, list, list);
+
+static pthread_mutex_t ctrl_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ctrl_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t ctrl_worker_thread;
+static IDM_T ctrl_worker_running = NO;
+static IDM_T ctrl_worker_quit = NO;
+
+static __thread IDM_T ctrl_worker_self = NO;
+
+STATIC_FUNC
+void ctrl_job_write(int fd, const char *s, uint32_t len)
+{
+        while (len) {
+                ssize_t w = write(fd, s, len);
+
+                if (w < 0 && errno == EINTR)
+                        continue;
+                else if (w <= 0)
+                        return;
+
+                s += w;
+                len -= w;
+        }
+}
+
+STATIC_FUNC
+void ctrl_job_run(struct ctrl_job *job)
+{
+        if (job->type == CTRL_JOB_TEXT) {
+
+                ctrl_job_write(job->fd, job->text, job->len);
+
+        } else if (job->type == CTRL_JOB_STATUS) {
+
+                struct status_snapshot *ss = job->snapshot;
+                char *out;
+
+                if (ss->data_len && (out = fields_dbg_table_str(job->relevance, ss->data_len, ss->data, ss->min_msg_size, ss->format))) {
+                        ctrl_job_write(job->fd, ss->status_name, strlen(ss->status_name));
+                        ctrl_job_write(job->fd, ":\n", 2);
+                        ctrl_job_write(job->fd, out, strlen(out));
+                        free(out);
+                }
+
+        } else if (job->type == CTRL_JOB_CLOSE) {
+
+                if (job->end)
+                        ctrl_job_write(job->fd, CONNECTION_END_STR, strlen(CONNECTION_END_STR));
+
+                close(job->fd);
+        }
+}
+
+STATIC_FUNC
+void *ctrl_worker(void *unused)
+{
+        struct ctrl_job *job;
+
+        ctrl_worker_self = YES;
+
+        pthread_mutex_lock(&ctrl_job_mutex);
+
+        while (1) {
+
+                while (!(job = list_del_head(&ctrl_job_queue)) && !ctrl_worker_quit)
+                        pthread_cond_wait(&ctrl_job_cond, &ctrl_job_mutex);
+
+                if (!job)
+                        break;
+
+                pthread_mutex_unlock(&ctrl_job_mutex);
+                ctrl_job_run(job);
+                pthread_mutex_lock(&ctrl_job_mutex);
+
+                list_add_tail(&ctrl_job_done, &job->list);
+        }
+
+        pthread_mutex_unlock(&ctrl_job_mutex);
+
+        return NULL;
+}
+
+STATIC_FUNC
+void ctrl_job_free(struct ctrl_job *job)
+{
+        if (job->snapshot)
+                status_snapshot_release(job->snapshot);
+
+        debugFree(job, -300587);
+}
+
+// frees (on the main thread) all jobs the worker is done with:
+void ctrl_worker_reap(void)
+{
+        struct ctrl_job *job;
+
+        if (!ctrl_worker_running)
+                return;
+
+        pthread_mutex_lock(&ctrl_job_mutex);
+
+        while ((job = list_del_head(&ctrl_job_done))) {
+                pthread_mutex_unlock(&ctrl_job_mutex);
+                ctrl_job_free(job);
+                pthread_mutex_lock(&ctrl_job_mutex);
+        }
+
+        pthread_mutex_unlock(&ctrl_job_mutex);
+}
+
+STATIC_FUNC
+void ctrl_job_enqueue(struct ctrl_job *job)
+{
+        if (!ctrl_worker_running) {
+                // worker stopped (terminating): preserve the output and its order by writing it straight away
+                ctrl_job_run(job);
+                ctrl_job_free(job);
+                return;
+        }
+
+        ctrl_worker_reap();
+
+        pthread_mutex_lock(&ctrl_job_mutex);
+        list_add_tail(&ctrl_job_queue, &job->list);
+        pthread_cond_signal(&ctrl_job_cond);
+        pthread_mutex_unlock(&ctrl_job_mutex);
+}
+
+STATIC_FUNC
+struct ctrl_job *ctrl_job_create(uint8_t type, int fd, uint32_t len)
+{
+        struct ctrl_job *job = debugMallocReset(sizeof (struct ctrl_job) + len + 1, -300587);
+
+        job->type = type;
+        job->fd = fd;
+        job->len = len;
+        return job;
+}
+
+void ctrl_worker_stop(void)
+{
+        if (!ctrl_worker_running)
+                return;
+
+        pthread_mutex_lock(&ctrl_job_mutex);
+        ctrl_worker_quit = YES;
+        pthread_cond_signal(&ctrl_job_cond);
+        pthread_mutex_unlock(&ctrl_job_mutex);
+
+        pthread_join(ctrl_worker_thread, NULL);
+
+        ctrl_worker_reap();
+
+        assertion(-501585, (LIST_EMPTY(&ctrl_job_queue) && LIST_EMPTY(&ctrl_job_done)));
+
+        ctrl_worker_running = NO;
+}
+
+/*
+ * Hands a status snapshot to the worker thread and switches all further output for cn
+ * (dbg_printf() and the final CONNECTION_END_STR) to the worker's queue to keep it in order.
+ */
+IDM_T ctrl_worker_status(struct ctrl_node *cn, struct status_snapshot *ss, uint16_t relevance)
+{
+        TRACE_FUNCTION_CALL;
+
+        if (terminating || !cn || cn->fd <= 0 || cn->fd == STDOUT_FILENO || cn->cn_fd_handler)
+                return FAILURE;
+
+        if (!ctrl_worker_running) {
+
+                ctrl_worker_quit = NO;
+
+                if ((errno = pthread_create(&ctrl_worker_thread, NULL, ctrl_worker, NULL))) {
+                        dbgf_sys(DBGT_ERR, "failed creating ctrl worker thread: %s", strerror(errno));
+                        return FAILURE;
+                }
+
+                ctrl_worker_running = YES;
+        }
+
+        if (!cn->worker_fd && (cn->worker_fd = dup(cn->fd)) < 0) {
+                dbgf_sys(DBGT_ERR, "failed dup fd=%d: %s", cn->fd, strerror(errno));
+                cn->worker_fd = 0;
+                return FAILURE;
+        }
+
+        struct ctrl_job *job = ctrl_job_create(CTRL_JOB_STATUS, cn->worker_fd, 0);
+        job->snapshot = ss;
+        job->relevance = relevance;
+        ss->users++;
+
+        ctrl_job_enqueue(job);
+
+        return SUCCESS;
+}
+
+STATIC_FUNC
+void ctrl_worker_close(struct ctrl_node *cn, IDM_T end)
+{
+        struct ctrl_job *job = ctrl_job_create(CTRL_JOB_CLOSE, cn->worker_fd, 0);
+        job->end = end;
+        cn->worker_fd = 0;
+        ctrl_job_enqueue(job);
+}
+
 void close_ctrl_node(uint8_t cmd, struct ctrl_node *cn)
 {
 
@@ -275,13 +506,17 @@ void close_ctrl_node(uint8_t cmd, struct ctrl_node *cn)
                                 dbgf_all(DBGT_INFO, "closed ctrl node fd %d with cmd %d", cn_tmp->fd, cmd);
 				
 				
-				if ( cmd == CTRL_CLOSE_SUCCESS ) {
+				if ( cn_tmp->worker_fd  &&  cmd != CTRL_CLOSE_DELAY ) {
+                                        ctrl_worker_close(cn_tmp, (cmd == CTRL_CLOSE_SUCCESS));
+
+                                } else if ( cmd == CTRL_CLOSE_SUCCESS ) {
                                         if (write(cn_tmp->fd, CONNECTION_END_STR, strlen(CONNECTION_END_STR)) < 0) {
                                                 dbgf_track(DBGT_WARN, "%s", strerror(errno));
                                         }
                                 }
 				
 				if ( cmd != CTRL_CLOSE_DELAY ) {
+					fd_event_close( cn_tmp->fd );
 					close( cn_tmp->fd );
 					cn_tmp->fd = 0;
 					change_selects();
@@ -301,7 +536,11 @@ void close_ctrl_node(uint8_t cmd, struct ctrl_node *cn)
 				remove_dbgl_node( cn_tmp );
 				//leaving this after remove_dbgl_node() prevents debugging via broken -d4 pipe
                                 dbgf_all(DBGT_INFO, "closed ctrl node fd %d", cn_tmp->fd);
+
+                                if ( cn_tmp->worker_fd )
+                                        ctrl_worker_close(cn_tmp, NO);
 				
+				fd_event_close( cn_tmp->fd );
 				close( cn_tmp->fd );
 				cn_tmp->fd = 0;
 				change_selects();
@@ -490,6 +729,9 @@ void debug_output(uint32_t check_len, struct ctrl_node *cn, int8_t dbgl, int8_t
 	uint8_t mute_dbgl_sys = DBG_HIST_NEW;
 	uint8_t mute_dbgl_changes = DBG_HIST_NEW;
 	
+	// the ctrl worker must not touch the (unlocked) debug clients and history:
+	if ( ctrl_worker_self )
+		return;
 	
 	if ( cn  &&  cn->fd != STDOUT_FILENO )
 		dbg_printf( cn, "%s%s: %s\n", dbgt2str[dbgt], f?f:"", s );
@@ -598,7 +840,7 @@ void debug_output(uint32_t check_len, struct ctrl_node *cn, int8_t dbgl, int8_t
 
 
 // this static array of char is used by all following dbg functions.
-static char dbg_string_out[ MAX_DBG_STR_SIZE + 1 ];
+static __thread char dbg_string_out[ MAX_DBG_STR_SIZE + 1 ];
 
 
 
@@ -674,6 +916,22 @@ void dbg_printf(struct ctrl_node *cn, char *last, ...)
         if (!cn || cn->fd <= 0)
                 return;
 
+        if (cn->worker_fd) {
+                // output must follow the status tables still queued for this client:
+                va_list ap;
+                va_start(ap, last);
+                int len = vsnprintf(NULL, 0, last, ap);
+                va_end(ap);
+
+                if (len > 0) {
+                        struct ctrl_job *job = ctrl_job_create(CTRL_JOB_TEXT, cn->worker_fd, len);
+                        va_start(ap, last);
+                        vsnprintf(job->text, len + 1, last, ap);
+                        va_end(ap);
+                        ctrl_job_enqueue(job);
+                }
+                return;
+        }
 
 /*
         static char s[ MAX_DBG_STR_SIZE + 1 ];
@@ -3105,6 +3363,8 @@ void cleanup_control(void)
 		close( unix_sock );
 	
 	unix_sock = 0;
+
+        ctrl_worker_stop();
 	
 	close_ctrl_node( CTRL_PURGE_ALL, NULL );
 	
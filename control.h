@@ -108,6 +108,7 @@ struct ctrl_node
 {
 	struct list_node list;
 	int fd;
+	int worker_fd; // dup of fd, owned by the ctrl worker once status output was handed to it
 	void (*cn_fd_handler) (struct ctrl_node *);
 	TIME_T closing_stamp;
 	uint8_t authorized;
@@ -221,6 +222,11 @@ void handle_ctrl_node( struct ctrl_node *cn );
 void close_ctrl_node( uint8_t cmd, struct ctrl_node *cn );
 struct ctrl_node *create_ctrl_node( int fd, void (*cn_fd_handler) (struct ctrl_node *), uint8_t authorized );
 
+struct status_snapshot;
+IDM_T ctrl_worker_status(struct ctrl_node *cn, struct status_snapshot *ss, uint16_t relevance);
+void ctrl_worker_reap(void);
+void ctrl_worker_stop(void);
+
 
 
 
@@ -45,6 +45,11 @@ static int32_t data_dev_plugin_registry = FAILURE;
 
 static struct dump_data dump_all;
 
+static struct rx_batch_statistics rx_batch_prev;
+static struct rx_batch_statistics rx_batch_pre; // per period, packets_max within period
+static struct tx_batch_statistics tx_batch_prev;
+static struct tx_batch_statistics tx_batch_pre;
+
 
 STATIC_FUNC
 void update_traffic_statistics_data(struct dump_data *data)
@@ -84,6 +89,18 @@ void update_traffic_statistics_task(void *data)
 
         update_traffic_statistics_data( &dump_all );
 
+        rx_batch_pre.wakeups = rx_batch_stats.wakeups - rx_batch_prev.wakeups;
+        rx_batch_pre.packets = rx_batch_stats.packets - rx_batch_prev.packets;
+        rx_batch_pre.packets_max = rx_batch_stats.packets_max;
+        rx_batch_pre.yields = rx_batch_stats.yields - rx_batch_prev.yields;
+        rx_batch_pre.drops = rx_batch_stats.drops - rx_batch_prev.drops;
+        rx_batch_stats.packets_max = 0;
+        rx_batch_prev = rx_batch_stats;
+
+        tx_batch_pre.packets = tx_batch_stats.packets - tx_batch_prev.packets;
+        tx_batch_pre.syscalls = tx_batch_stats.syscalls - tx_batch_prev.syscalls;
+        tx_batch_prev = tx_batch_stats;
+
         while ((dev = avl_iterate_item(&dev_name_tree, &an))) {
 
                 struct dump_data **dump_dev_plugin_data =
@@ -117,7 +134,7 @@ void dump(struct packet_buff *pb)
         uint16_t plength = ntohs(phdr->pkt_length);
 
         dbgf_dump(DBGT_NONE, "%s srcIP=%-16s dev=%-12s udpPayload=%-d",
-                direction == DUMP_DIRECTION_IN ? "in " : "out", pb->i.llip_str, dev->label_cfg.str, plength);
+                direction == DUMP_DIRECTION_IN ? "in " : "out", pb->i.llip_str, dev->ifname_label.str, plength);
 
         dbgf_dump(DBGT_NONE, "%s data: %s",
                 direction == DUMP_DIRECTION_IN ? "in " : "out", memAsHexString(((uint8_t*) phdr), plength));
@@ -342,18 +359,34 @@ int32_t opt_traffic_statistics(uint8_t cmd, uint8_t _save, struct opt_type *opt,
 
                 dbg_printf(cn, "%20s ( %% )     in ( %% )    out ( %% )  |   all ( %% )     in ( %% )    out ( %% )\n"," ");
 
-                if (!strcmp(patch->val, ARG_DUMP_ALL) || !strcmp(patch->val, ARG_DUMP_SUMMARY))
+                if (!strcmp(patch->val, ARG_DUMP_ALL) || !strcmp(patch->val, ARG_DUMP_SUMMARY)) {
+
                         dbg_traffic_statistics(&dump_all, cn, ARG_DUMP_ALL);
 
+                        dbg_printf(cn, "%13s  wakeups=%d packets=%d packets/wakeup=%d.%d maxPackets/wakeup=%d yields=%d drops=%d\n", "RX_BATCH",
+                                (int) ((((int64_t) rx_batch_pre.wakeups) * 1000) / curr_dump_period),
+                                (int) ((((int64_t) rx_batch_pre.packets) * 1000) / curr_dump_period),
+                                rx_batch_pre.wakeups ? (rx_batch_pre.packets / rx_batch_pre.wakeups) : 0,
+                                rx_batch_pre.wakeups ? (((rx_batch_pre.packets * 10) / rx_batch_pre.wakeups) % 10) : 0,
+                                rx_batch_pre.packets_max,
+                                (int) ((((int64_t) rx_batch_pre.yields) * 1000) / curr_dump_period),
+                                (int) ((((int64_t) rx_batch_pre.drops) * 1000) / curr_dump_period));
+
+                        dbg_printf(cn, "%13s  packets=%d syscalls=%d syscallsSaved=%d\n", "TX_BATCH",
+                                (int) ((((int64_t) tx_batch_pre.packets) * 1000) / curr_dump_period),
+                                (int) ((((int64_t) tx_batch_pre.syscalls) * 1000) / curr_dump_period),
+                                (int) ((((int64_t) (tx_batch_pre.packets - tx_batch_pre.syscalls)) * 1000) / curr_dump_period));
+                }
+
                 while ((dev = avl_iterate_item(&dev_name_tree, &an))) {
 
-                        if (!strcmp(patch->val, ARG_DUMP_ALL) || !strcmp(patch->val, dev->label_cfg.str)) {
+                        if (!strcmp(patch->val, ARG_DUMP_ALL) || !strcmp(patch->val, dev->ifname_label.str)) {
 
 				struct dump_data **dump_dev_plugin_data = (struct dump_data **)
 				(get_plugin_data(dev, PLUGIN_DATA_DEV, data_dev_plugin_registry));
 
 				if (dev->active && *dump_dev_plugin_data)
-					dbg_traffic_statistics(*dump_dev_plugin_data, cn, dev->label_cfg.str);
+					dbg_traffic_statistics(*dump_dev_plugin_data, cn, dev->ifname_label.str);
 			}
                 }
 
@@ -423,6 +456,8 @@ STATIC_FUNC
 int32_t init_dump( void )
 {
         memset(&dump_all, 0, sizeof (struct dump_data));
+        rx_batch_prev = rx_batch_stats;
+        tx_batch_prev = tx_batch_stats;
 
         data_dev_plugin_registry = get_plugin_data_registry(PLUGIN_DATA_DEV);
 
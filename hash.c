@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2010  Axel Neumann
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bmx.h"
+#include "hash.h"
+
+#define CODE_CATEGORY_NAME "hash"
+
+#define HASH_ITEM_KEY( hi, item ) ( (void*) ( ((char*)(item)) + ((hi)->key_offset) ) )
+
+STATIC_INLINE_FUNC
+uint32_t hash_key(struct hash_index *hi, const void *key)
+{
+	const uint8_t *k = key;
+	uint32_t h, w, i;
+
+	if (hi->key_type == HASH_KEY_RANDOM) {
+		memcpy(&h, k, sizeof (h));
+		return h;
+	}
+
+	// murmur2-like mixing of 32-bit words and trailing bytes:
+	for (h = hi->key_size * 0x9E3779B9, i = 0; i + sizeof (w) <= hi->key_size; i += sizeof (w)) {
+		memcpy(&w, k + i, sizeof (w));
+		w *= 0x5BD1E995;
+		w ^= w >> 24;
+		h = (h * 0x5BD1E995) ^ (w * 0x5BD1E995);
+	}
+
+	for (; i < hi->key_size; i++)
+		h = (h ^ k[i]) * 0x5BD1E995;
+
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+STATIC_FUNC
+void hash_resize(struct hash_index *hi, uint32_t slots)
+{
+	struct hash_slot *old = hi->slots;
+	uint32_t old_slots = old ? hi->mask + 1 : 0;
+	uint32_t i, j;
+
+	hi->slots = debugMallocReset(slots * sizeof (struct hash_slot), -300599);
+	hi->mask = slots - 1;
+
+	for (i = 0; i < old_slots; i++) {
+
+		if (!old[i].item)
+			continue;
+
+		for (j = old[i].hash & hi->mask; hi->slots[j].item; j = (j + 1) & hi->mask);
+
+		hi->slots[j] = old[i];
+	}
+
+	if (old)
+		debugFree(old, -300600);
+}
+
+struct hash_index *hash_create(uint16_t key_size, uint16_t key_offset, uint8_t key_type)
+{
+	uint8_t duplicates = (key_type & HASH_KEY_DUPLICATES) ? 1 : 0;
+
+	key_type &= ~HASH_KEY_DUPLICATES;
+
+	assertion(-501610, (key_type == HASH_KEY_MIXED || (key_type == HASH_KEY_RANDOM && key_size >= sizeof (uint32_t))));
+
+	struct hash_index *hi = debugMallocReset(sizeof (struct hash_index), -300598);
+
+	hi->key_size = key_size;
+	hi->key_offset = key_offset;
+	hi->key_type = key_type;
+	hi->duplicates = duplicates;
+
+	hash_resize(hi, HASH_SLOTS_MIN);
+
+	return hi;
+}
+
+void hash_destroy(struct hash_index *hi)
+{
+	debugFree(hi->slots, -300600);
+	debugFree(hi, -300601);
+}
+
+void *hash_find(struct hash_index *hi, void *key)
+{
+	uint32_t h = hash_key(hi, key);
+	uint32_t i;
+
+	for (i = h & hi->mask; hi->slots[i].item; i = (i + 1) & hi->mask) {
+
+		if (hi->slots[i].hash == h && !memcmp(HASH_ITEM_KEY(hi, hi->slots[i].item), key, hi->key_size))
+			return hi->slots[i].item;
+	}
+
+	return NULL;
+}
+
+void hash_insert(struct hash_index *hi, void *item)
+{
+	uint32_t h, i;
+
+	if ((hi->items + 1) * 2 > hi->mask + 1)
+		hash_resize(hi, (hi->mask + 1) * 2);
+
+	h = hash_key(hi, HASH_ITEM_KEY(hi, item));
+
+	for (i = h & hi->mask; hi->slots[i].item; i = (i + 1) & hi->mask) {
+
+		assertion(-501611, (hi->duplicates || hi->slots[i].hash != h ||
+			memcmp(HASH_ITEM_KEY(hi, hi->slots[i].item), HASH_ITEM_KEY(hi, item), hi->key_size)));
+	}
+
+	hi->slots[i].hash = h;
+	hi->slots[i].item = item;
+	hi->items++;
+}
+
+void hash_remove(struct hash_index *hi, void *item)
+{
+	uint32_t i, j, home;
+
+	for (i = hash_key(hi, HASH_ITEM_KEY(hi, item)) & hi->mask; hi->slots[i].item != item; i = (i + 1) & hi->mask)
+		assertion(-501612, (hi->slots[i].item));
+
+	// shift following entries of the probe sequence back into the gap:
+	for (j = (i + 1) & hi->mask; hi->slots[j].item; j = (j + 1) & hi->mask) {
+
+		home = hi->slots[j].hash & hi->mask;
+
+		if (((j - home) & hi->mask) >= ((j - i) & hi->mask)) {
+			hi->slots[i] = hi->slots[j];
+			i = j;
+		}
+	}
+
+	hi->slots[i].item = NULL;
+	hi->slots[i].hash = 0;
+	hi->items--;
+
+	if (hi->mask + 1 > HASH_SLOTS_MIN && hi->items * 8 < hi->mask + 1)
+		hash_resize(hi, (hi->mask + 1) / 2);
+}
+
+// whether item is found in the probe sequence of its current key, false if the key changed after hash_insert()
+int hash_has_item(struct hash_index *hi, void *item)
+{
+	uint32_t i;
+
+	for (i = hash_key(hi, HASH_ITEM_KEY(hi, item)) & hi->mask; hi->slots[i].item; i = (i + 1) & hi->mask) {
+
+		if (hi->slots[i].item == item)
+			return YES;
+	}
+
+	return NO;
+}
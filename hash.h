@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2010  Axel Neumann
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ */
+
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdint.h>
+
+/*
+ * Open-addressing hash index for exact-match lookups of items by a key at a fixed offset.
+ * Linear probing in a power-of-two slot array kept between 1/8 and 1/2 full, removal by backward shifting
+ * (no tombstones). Each slot caches the full 32-bit hash so probes rarely touch the items themselves.
+ */
+
+#define HASH_KEY_NONE   0
+#define HASH_KEY_MIXED  1 // any key, all bytes are mixed into the hash
+#define HASH_KEY_RANDOM 2 // first 4 key bytes are uniformly random (SHA1 prefix), used as hash directly
+#define HASH_KEY_DUPLICATES 0x80 // or-ed to the above: several items may share a key, hash_find() returns any of them
+
+#define HASH_SLOTS_MIN 16
+
+struct hash_slot {
+	uint32_t hash;
+	void *item;
+};
+
+struct hash_index {
+	uint16_t key_size;
+	uint16_t key_offset;
+	uint8_t key_type;
+	uint8_t duplicates;
+	uint32_t mask; // slots - 1
+	uint32_t items;
+	struct hash_slot *slots;
+};
+
+struct hash_index *hash_create(uint16_t key_size, uint16_t key_offset, uint8_t key_type);
+void hash_destroy(struct hash_index *hi);
+void *hash_find(struct hash_index *hi, void *key);
+void hash_insert(struct hash_index *hi, void *item);
+void hash_remove(struct hash_index *hi, void *item);
+int hash_has_item(struct hash_index *hi, void *item);
+
+#endif
@@ -56,6 +56,7 @@ static AVL_TREE(global_uhna_tree, struct hna_node, key );
 static AVL_TREE(local_uhna_tree, struct hna_node, key );
 
 AVL_TREE(tun_in_tree, struct tun_in_node, nameKey);             // configured tun_in tunnels
+static AVL_INDEX(tun_in_remote_index, struct tun_in_node, remote); // tun_in_tree by remote ip
 
 static AVL_TREE(tun_search_tree, struct tun_search_node, nameKey); // configured tun_out names searches
 //static AVL_TREE(tun_search_net_tree, struct tun_search_node, tunSearchKey); //REMOVE // configured tun_out networks searches
@@ -377,8 +378,10 @@ void reconfigure_tun_ins(void)
 		for (an = NULL; (tin = avl_iterate_item(&tun_in_tree, &an));) {
 
 			if (!tin->remote_manual) {
+				avl_index_unlink(&tun_in_tree, tin);
 				tin->remote = autoRemotePrefix.ip;
 				tin->remote.s6_addr[7] = m;
+				avl_index_link(&tun_in_tree, tin);
 			}
 
 			configure_tunnel_in(ADD, tin, m++);
@@ -1909,7 +1912,7 @@ int process_description_tlv_tun6_adv(struct rx_frame_iterator *it)
 
                         if (!is_ip_valid(&adv->localIp, AF_INET6) ||
                                 is_ip_net_equal(&adv->localIp, &IP6_LINKLOCAL_UC_PREF, IP6_LINKLOCAL_UC_PLEN, AF_INET6) ||
-                                (tin = avl_find_item_by_field(&tun_in_tree, &adv->localIp, tun_in_node, remote)) ||
+                                (tin = avl_index_find_item(&tun_in_remote_index, &adv->localIp)) ||
                                 (un = find_overlapping_hna(&adv->localIp, 128, it->on))) {
                                 dbgf_sys(DBGT_ERR, "globalId=%s %s=%s blocked (by my %s=%s or other's %s with globalId=%s)",
                                         globalIdAsString(&it->on->global_id), ARG_TUN_DEV, ip6AsStr(&adv->localIp),
@@ -3060,7 +3063,9 @@ int32_t opt_tun_in_dev(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct
                                 }
 
                                 if (cmd == OPT_APPLY && tin) {
+                                        avl_index_unlink(&tun_in_tree, tin);
                                         tin->remote = p6.ip;
+                                        avl_index_link(&tun_in_tree, tin);
                                         tin->remote_manual = c->val ? 1 : 0;
                                 }
 
@@ -3542,6 +3547,8 @@ int32_t hna_init( void )
         //assertion(-501327, tun_search_net_tree.key_size == sizeof (struct tun_search_key));
         assertion(-501328, tun_search_tree.key_size == NETWORK_NAME_LEN);
 
+        avl_index_add(&tun_in_tree, &tun_in_remote_index);
+
 
         
         static const struct field_format hna4_format[] = DESCRIPTION_MSG_HNA4_FORMAT;
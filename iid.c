@@ -22,42 +22,157 @@
 #include "iid.h"
 #include "tools.h"
 
-struct iid_repos my_iid_repos = { 0,0,0,0,{NULL} };
+struct iid_repos my_iid_repos = { 0,0,0,0,NULL,{NULL} };
 
+#define IID_WORD( iid ) ( (iid) / IID_REPOS_WORD_BITS )
+#define IID_BIT( iid ) ( ((uint32_t) 1) << ((iid) % IID_REPOS_WORD_BITS) )
+
+STATIC_INLINE_FUNC
+IDM_T iid_is_used(struct iid_repos *rep, IID_T iid)
+{
+        return (rep->used[IID_WORD(iid)] & IID_BIT(iid)) ? YES : NO;
+}
+
+// returns the first unused field >= iid, or arr_size if all are used
+STATIC_INLINE_FUNC
+IID_T iid_next_free(struct iid_repos *rep, IID_T iid)
+{
+        uint32_t w = IID_WORD(iid);
+        uint32_t words = IID_WORD(rep->arr_size);
+        uint32_t free;
+
+        if (w >= words)
+                return rep->arr_size;
+
+        for (free = ~(rep->used[w]) & ~(IID_BIT(iid) - 1); !free; free = ~(rep->used[w])) {
+
+                if (++w >= words)
+                        return rep->arr_size;
+        }
+
+        return (w * IID_REPOS_WORD_BITS) + __builtin_ctz(free);
+}
+
+// returns the first unused field after the last used one below iid, or IID_MIN_USED if there is none
+STATIC_INLINE_FUNC
+IID_T iid_max_free_below(struct iid_repos *rep, IID_T iid)
+{
+        if (iid <= IID_MIN_USED)
+                return IID_MIN_USED;
+
+        uint32_t w = IID_WORD(iid - 1);
+        uint32_t used = rep->used[w] & ((IID_BIT(iid - 1) - 1) | IID_BIT(iid - 1));
+
+        while (!used) {
+
+                if (!w)
+                        return IID_MIN_USED;
+
+                used = rep->used[--w];
+        }
+
+        return XMAX(IID_MIN_USED, (w * IID_REPOS_WORD_BITS) + (IID_REPOS_WORD_BITS - __builtin_clz(used)));
+}
+
+/*
+ * A neighIID4x_repos page only stores the used fields of its bitmap word, so a field is found at the rank of its
+ * bit among the set bits of the word. Pages are sized to a multiple of IID_REPOS_PAGE_STEP that follows from
+ * the number of set bits, so no capacity needs to be stored.
+ */
+STATIC_INLINE_FUNC
+struct iid_ref *iid_neigh_ref(struct iid_repos *rep, IID_T iid)
+{
+        if (!iid_is_used(rep, iid))
+                return NULL;
+
+        return &(rep->arr.page[IID_WORD(iid)][__builtin_popcount(rep->used[IID_WORD(iid)] & (IID_BIT(iid) - 1))]);
+}
+
+// inserts the field for iid into its page, must be followed by setting its used bit
+STATIC_FUNC
+void iid_neigh_page_insert(struct iid_repos *rep, IID_T iid)
+{
+        uint32_t w = IID_WORD(iid);
+        uint32_t fields = __builtin_popcount(rep->used[w]);
+        uint32_t rank = __builtin_popcount(rep->used[w] & (IID_BIT(iid) - 1));
+
+        if (!(fields % IID_REPOS_PAGE_STEP))
+                rep->arr.page[w] = debugRealloc(rep->arr.page[w], (fields + IID_REPOS_PAGE_STEP) * sizeof (struct iid_ref), -300612);
+
+        memmove(&(rep->arr.page[w][rank + 1]), &(rep->arr.page[w][rank]), (fields - rank) * sizeof (struct iid_ref));
+        memset(&(rep->arr.page[w][rank]), 0, sizeof (struct iid_ref));
+}
+
+// removes the field for iid from its page, must be followed by clearing its used bit
+STATIC_FUNC
+void iid_neigh_page_remove(struct iid_repos *rep, IID_T iid)
+{
+        uint32_t w = IID_WORD(iid);
+        uint32_t fields = __builtin_popcount(rep->used[w]) - 1;
+        uint32_t rank = __builtin_popcount(rep->used[w] & (IID_BIT(iid) - 1));
+
+        if (!fields) {
+                debugFree(rep->arr.page[w], -300610);
+                rep->arr.page[w] = NULL;
+                return;
+        }
+
+        memmove(&(rep->arr.page[w][rank]), &(rep->arr.page[w][rank + 1]), (fields - rank) * sizeof (struct iid_ref));
+
+        if (!(fields % IID_REPOS_PAGE_STEP))
+                rep->arr.page[w] = debugRealloc(rep->arr.page[w], fields * sizeof (struct iid_ref), -300612);
+}
+
+/*
+ * Doubles the size of a repository (the first time allocating IID_REPOS_SIZE_BLOCK fields).
+ * my_iid_repos is a plain array of node pointers. A neighIID4x_repos only holds a directory of pages which are
+ * allocated on first use, so neighbours referring to few IIDs of a large IID space cost little memory.
+ */
 int8_t iid_extend_repos(struct iid_repos *rep)
 {
         TRACE_FUNCTION_CALL;
 
+        int m = (rep == &my_iid_repos);
+        uint32_t size = rep->arr_size ? (2 * (uint32_t) rep->arr_size) : IID_REPOS_SIZE_BLOCK;
+
         dbgf_all(DBGT_INFO, "sizeof iid: %zu,  tot_used %d  arr_size %d ",
-                (rep == &my_iid_repos) ? sizeof (IID_NODE_T*) : sizeof (IID_T), rep->tot_used, rep->arr_size);
+                m ? sizeof (IID_NODE_T*) : sizeof (IID_T), rep->tot_used, rep->arr_size);
 
         assertion(-500217, (rep != &my_iid_repos || IID_SPREAD_FK != 1 || rep->tot_used == rep->arr_size));
+        assertion(-501631, (!(IID_REPOS_SIZE_BLOCK % IID_REPOS_WORD_BITS)));
 
-        if (rep->arr_size + IID_REPOS_SIZE_BLOCK >= IID_REPOS_SIZE_WARN) {
+        if (size >= IID_REPOS_SIZE_WARN) {
 
                 dbgf_sys(DBGT_WARN, "%d", rep->arr_size);
 
-                if (rep->arr_size + IID_REPOS_SIZE_BLOCK >= IID_REPOS_SIZE_MAX)
+                size = XMIN(size, (IID_REPOS_SIZE_MAX / IID_REPOS_SIZE_BLOCK) * IID_REPOS_SIZE_BLOCK);
+
+                if (size <= rep->arr_size)
                         return FAILURE;
         }
 
-        int field_size = (rep == &my_iid_repos) ? sizeof (IID_NODE_T*) : sizeof (struct iid_ref);
+        uint32_t field_size = sizeof (void*);
+        uint32_t old_fields = m ? rep->arr_size : IID_WORD(rep->arr_size);
+        uint32_t new_fields = m ? size : IID_WORD(size);
 
         if (rep->arr_size) {
 
-                rep->arr.u8 = debugRealloc(rep->arr.u8, (rep->arr_size + IID_REPOS_SIZE_BLOCK) * field_size, -300035);
+                rep->arr.u8 = debugRealloc(rep->arr.u8, new_fields * field_size, -300035);
+                rep->used = debugRealloc(rep->used, IID_WORD(size) * sizeof (uint32_t), -300608);
 
         } else {
 
-                rep->arr.u8 = debugMalloc(IID_REPOS_SIZE_BLOCK * field_size, -300085);
+                rep->arr.u8 = debugMalloc(new_fields * field_size, -300085);
+                rep->used = debugMalloc(IID_WORD(size) * sizeof (uint32_t), -300609);
                 rep->tot_used = IID_RSVD_MAX+1;
                 rep->min_free = IID_RSVD_MAX+1;
                 rep->max_free = IID_RSVD_MAX+1;
         }
 
-        memset(&(rep->arr.u8[rep->arr_size * field_size]), 0, IID_REPOS_SIZE_BLOCK * field_size);
+        memset(&(rep->arr.u8[old_fields * field_size]), 0, (new_fields - old_fields) * field_size);
+        memset(&(rep->used[IID_WORD(rep->arr_size)]), 0, (IID_WORD(size) - IID_WORD(rep->arr_size)) * sizeof (uint32_t));
 
-        rep->arr_size += IID_REPOS_SIZE_BLOCK;
+        rep->arr_size = size;
 
         return SUCCESS;
 }
@@ -67,9 +182,23 @@ void iid_purge_repos( struct iid_repos *rep )
 {
         TRACE_FUNCTION_CALL;
 
+        uint32_t w;
+
+        if (rep != &my_iid_repos) {
+
+                for (w = 0; w < IID_WORD(rep->arr_size); w++) {
+
+                        if (rep->arr.page[w])
+                                debugFree(rep->arr.page[w], -300610);
+                }
+        }
+
         if (rep->arr.u8)
                 debugFree(rep->arr.u8, -300135);
 
+        if (rep->used)
+                debugFree(rep->used, -300611);
+
         memset(rep, 0, sizeof ( struct iid_repos));
 
 }
@@ -81,29 +210,20 @@ void iid_free(struct iid_repos *rep, IID_T iid)
 
         assertion(-500330, (iid > IID_RSVD_MAX));
         assertion(-500228, (iid < rep->arr_size && iid < rep->max_free && rep->tot_used > IID_RSVD_MAX));
-        assertion(-500229, ((m ? (rep->arr.node[iid] != NULL) : (rep->arr.ref[iid].myIID4x) != 0)));
+        assertion(-501632, (iid_is_used(rep, iid)));
+        assertion(-500229, ((m ? (rep->arr.node[iid] != NULL) : (iid_neigh_ref(rep, iid)->myIID4x) != 0)));
 
-        if (m) {
+        if (m)
                 rep->arr.node[iid] = NULL;
-        } else {
-                rep->arr.ref[iid].myIID4x = 0;
-                rep->arr.ref[iid].referred_by_neigh_timestamp_sec = 0;
-        }
-
-        rep->min_free = XMIN(rep->min_free, iid);
+        else
+                iid_neigh_page_remove(rep, iid);
 
-        if (rep->max_free == iid + 1) {
+        rep->used[IID_WORD(iid)] &= ~IID_BIT(iid);
 
-                IID_T i;
-
-                for (i = iid; i > IID_MIN_USED; i--) {
-
-                        if (m ? (rep->arr.node[i - 1] != NULL) : (rep->arr.ref[i - 1].myIID4x) != 0)
-                                break;
-                }
+        rep->min_free = XMIN(rep->min_free, iid);
 
-                rep->max_free = i;
-        }
+        if (rep->max_free == iid + 1)
+                rep->max_free = iid_max_free_below(rep, iid);
 
         rep->tot_used--;
 
@@ -157,10 +277,10 @@ IID_NODE_T* iid_get_node_by_neighIID4x(IID_NEIGH_T *nn, IID_T neighIID4x, IDM_T
                 return NULL;
         }
 
-        struct iid_ref *ref = &(nn->neighIID4x_repos.arr.ref[neighIID4x]);
+        struct iid_ref *ref = iid_neigh_ref(&nn->neighIID4x_repos, neighIID4x);
 
 
-        if (!ref->myIID4x ) {
+        if (!ref || !ref->myIID4x ) {
                 if (verbose) {
                         dbgf_all(DBGT_WARN, "neighIID4x=%d not recorded by neighIID4x_repos", neighIID4x);
                 }
@@ -207,26 +327,23 @@ void _iid_set(struct iid_repos *rep, IID_T IIDpos, IID_T myIID4x, IID_NODE_T *dh
         assertion(-500531, (!dhn || rep == &my_iid_repos));
         assertion(-500535, (IIDpos >= IID_MIN_USED));
 
-        rep->tot_used++;
-        rep->max_free = XMAX( rep->max_free, IIDpos+1 );
-
-        IID_T min = rep->min_free;
+        assertion(-501633, (IIDpos < rep->arr_size && !iid_is_used(rep, IIDpos)));
 
-        if (min == IIDpos) {
-                for (min++; min < rep->arr_size; min++) {
+        if (myIID4x)
+                iid_neigh_page_insert(rep, IIDpos);
 
-                        if (myIID4x ? !(rep->arr.ref[min].myIID4x) : !(rep->arr.node[min]))
-                                break;
-                }
-        }
+        rep->tot_used++;
+        rep->max_free = XMAX( rep->max_free, IIDpos+1 );
+        rep->used[IID_WORD(IIDpos)] |= IID_BIT(IIDpos);
 
-        assertion(-500244, (min <= rep->max_free));
+        if (rep->min_free == IIDpos)
+                rep->min_free = iid_next_free(rep, IIDpos + 1);
 
-        rep->min_free = min;
+        assertion(-500244, (rep->min_free <= rep->max_free));
 
         if (myIID4x) {
-                rep->arr.ref[IIDpos].myIID4x = myIID4x;
-                rep->arr.ref[IIDpos].referred_by_neigh_timestamp_sec = bmx_time_sec;
+                iid_neigh_ref(rep, IIDpos)->myIID4x = myIID4x;
+                iid_neigh_ref(rep, IIDpos)->referred_by_neigh_timestamp_sec = bmx_time_sec;
         } else {
                 rep->arr.node[IIDpos] = dhn;
                 dhn->referred_by_me_timestamp = bmx_time;
@@ -291,12 +408,13 @@ IDM_T iid_set_neighIID4x(struct iid_repos *neigh_rep, IID_T neighIID4x, IID_T my
         assertion(-500485, (dhn && dhn->on));
 
         dhn->referred_by_me_timestamp = bmx_time;
+        status_orig_changed(dhn->on);
 
         if (neigh_rep->max_free > neighIID4x) {
 
-                struct iid_ref *ref = &(neigh_rep->arr.ref[neighIID4x]);
+                struct iid_ref *ref = iid_neigh_ref(neigh_rep, neighIID4x);
 
-                if (ref->myIID4x > IID_RSVD_MAX) {
+                if (ref && ref->myIID4x > IID_RSVD_MAX) {
 
                         if (ref->myIID4x == myIID4x ||
                                 (((uint16_t)(((uint16_t) bmx_time_sec) - ref->referred_by_neigh_timestamp_sec)) >=
@@ -327,7 +445,7 @@ IDM_T iid_set_neighIID4x(struct iid_repos *neigh_rep, IID_T neighIID4x, IID_T my
                         return FAILURE;
                 }
 
-                assertion(-500242, (ref->myIID4x == IID_RSVD_UNUSED));
+                assertion(-500242, (!ref || ref->myIID4x == IID_RSVD_UNUSED));
         }
 
 
@@ -345,8 +463,7 @@ IDM_T iid_set_neighIID4x(struct iid_repos *neigh_rep, IID_T neighIID4x, IID_T my
                 iid_extend_repos(neigh_rep);
         }
 
-        assertion(-500243, ((neigh_rep->arr_size > neighIID4x &&
-                (neigh_rep->max_free <= neighIID4x || neigh_rep->arr.ref[neighIID4x].myIID4x == IID_RSVD_UNUSED))));
+        assertion(-500243, ((neigh_rep->arr_size > neighIID4x && !iid_is_used(neigh_rep, neighIID4x))));
 
         _iid_set( neigh_rep, neighIID4x, myIID4x, NULL);
 
@@ -360,19 +477,32 @@ void iid_free_neighIID4x_by_myIID4x( struct iid_repos *rep, IID_T myIID4x)
         assertion(-500282, (rep != &my_iid_repos));
         assertion(-500328, (myIID4x > IID_RSVD_MAX));
 
-        IID_T p;
+        uint32_t w, used, rank;
         uint16_t removed = 0;
 
-        for (p = IID_RSVD_MAX + 1; p < rep->max_free; p++) {
+        // only visit used fields, walking each page along the set bits of its word:
+        for (w = 0; w * IID_REPOS_WORD_BITS < rep->max_free; w++) {
 
-                if (rep->arr.ref[p].myIID4x == myIID4x) {
+                for (used = rep->used[w], rank = 0; used; used &= (used - 1)) {
 
-                        if (removed++) {
-                                // there could indeed be several (if the neigh has timeouted this node and learned it again later)
-                                dbgf(DBGL_TEST, DBGT_INFO, "removed %d. stale rep->arr.sid[%d] = %d", removed, p, myIID4x);
-                        }
+                        IID_T p = (w * IID_REPOS_WORD_BITS) + __builtin_ctz(used);
+
+                        if (rep->arr.page[w][rank].myIID4x != myIID4x) {
+
+                                rank++;
 
-                        iid_free(rep, p);
+                        } else {
+
+                                if (removed++) {
+                                        // there could indeed be several (if the neigh has timeouted this node and learned it again later)
+                                        dbgf(DBGL_TEST, DBGT_INFO, "removed %d. stale rep->arr.sid[%d] = %d", removed, p, myIID4x);
+                                }
+
+                                iid_free(rep, p);
+
+                                if (!rep->arr_size)
+                                        return;
+                        }
                 }
         }
 }
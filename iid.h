@@ -20,7 +20,9 @@
 
 
 
-#define IID_REPOS_SIZE_BLOCK 32
+#define IID_REPOS_SIZE_BLOCK 32 // initial size, repositories grow by doubling and stay a multiple of it
+#define IID_REPOS_WORD_BITS  32 // fields per word of the used bitmap and per neighIID4x_repos page
+#define IID_REPOS_PAGE_STEP  4  // neighIID4x_repos pages grow and shrink by this many iid_refs
 
 #define IID_REPOS_SIZE_MAX  ((IID_T)(-1))
 #define IID_REPOS_SIZE_WARN 1024
@@ -42,10 +44,11 @@ struct iid_repos {
 	IID_T min_free; // the first unused array field from the beginning of the array (might be outside of allocated space)
 	IID_T max_free; // the first unused array field after the last used field in the array (might be outside of allocated space)
 	IID_T tot_used; // the total number of used fields in the array
+	uint32_t *used; // one bit per allocated field, set if used
 	union {
 		uint8_t *u8;
-		IID_NODE_T **node;
-		struct iid_ref *ref;
+		IID_NODE_T **node; // my_iid_repos: one pointer per field
+		struct iid_ref **page; // neighIID4x_repos: per bitmap word, only its used fields in IID order, NULL if none
 	} arr;
 };
 
@@ -483,8 +483,8 @@ IPX_T ip4ToX(IP4_T ip4)
 
 char *ipXAsStr(int family, const IPX_T *addr)
 {
-	static uint8_t c=0;
-        static char str[IP2S_ARRAY_LEN][INET6_ADDRSTRLEN];
+	static __thread uint8_t c=0;
+        static __thread char str[IP2S_ARRAY_LEN][INET6_ADDRSTRLEN];
 
 	c = (c+1) % IP2S_ARRAY_LEN;
 
@@ -501,8 +501,8 @@ char *ipFAsStr(const IPX_T *addr)
 char *ip4AsStr( IP4_T addr )
 {
 
-	static uint8_t c=0;
-	static char str[IP2S_ARRAY_LEN][INET_ADDRSTRLEN];
+	static __thread uint8_t c=0;
+	static __thread char str[IP2S_ARRAY_LEN][INET_ADDRSTRLEN];
 
 	c = (c+1) % IP2S_ARRAY_LEN;
 
@@ -513,8 +513,8 @@ char *ip4AsStr( IP4_T addr )
 
 char *netAsStr(const struct net_key *net)
 {
-	static uint8_t c=0;
-        static char str[IP2S_ARRAY_LEN][IPXNET_STR_LEN];
+	static __thread uint8_t c=0;
+        static __thread char str[IP2S_ARRAY_LEN][IPXNET_STR_LEN];
 
 	c = (c+1) % IP2S_ARRAY_LEN;
 
@@ -2277,16 +2277,19 @@ void dev_deactivate( struct dev_node *dev )
 
 
 		if (dev->unicast_sock) {
+			fd_event_close(dev->unicast_sock);
 			close(dev->unicast_sock);
                         dev->unicast_sock = 0;
                 }
 
 		if (dev->rx_mcast_sock) {
+			fd_event_close(dev->rx_mcast_sock);
 			close(dev->rx_mcast_sock);
                         dev->rx_mcast_sock = 0;
                 }
 
                 if (dev->rx_fullbrc_sock) {
+                        fd_event_close(dev->rx_fullbrc_sock);
                         close(dev->rx_fullbrc_sock);
                         dev->rx_fullbrc_sock = 0;
                 }
@@ -2382,6 +2385,23 @@ struct sockaddr_storage set_sockaddr_storage(uint8_t af, IPX_T *ipx, int32_t por
 }
 
 
+// let the kernel attach receive timestamps as cmsg to every packet (see rx_timestamp())
+STATIC_FUNC
+void dev_sock_timestamps(int32_t sock)
+{
+        int set_on = 1;
+
+#ifdef SO_TIMESTAMPNS
+        if (!setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &set_on, sizeof (set_on)))
+                return;
+#endif
+#ifdef SO_TIMESTAMP
+        if (!setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &set_on, sizeof (set_on)))
+                return;
+#endif
+        dbgf_sys(DBGT_WARN, "No SO_TIMESTAMPNS or SO_TIMESTAMP support, using wakeup time for received packets");
+}
+
 STATIC_FUNC
 IDM_T dev_init_sockets(struct dev_node *dev)
 {
@@ -2449,13 +2469,7 @@ IDM_T dev_init_sockets(struct dev_node *dev)
         sock_opts = fcntl(dev->unicast_sock, F_GETFL, 0);
         fcntl(dev->unicast_sock, F_SETFL, sock_opts | O_NONBLOCK);
 
-#ifdef SO_TIMESTAMP
-        if (setsockopt(dev->unicast_sock, SOL_SOCKET, SO_TIMESTAMP, &set_on, sizeof (set_on))) {
-                dbgf_sys(DBGT_WARN, "No SO_TIMESTAMP support, despite being defined, falling back to SIOCGSTAMP");
-        }
-#else
-        dbgf_sys(DBGT_WARN, "No SO_TIMESTAMP support, falling back to SIOCGSTAMP");
-#endif
+        dev_sock_timestamps(dev->unicast_sock);
 
 
         dev->tx_netwbrc_addr = set_sockaddr_storage(AF_CFG, &dev->if_llocal_addr->ip_mcast, base_port);
@@ -2473,6 +2487,8 @@ IDM_T dev_init_sockets(struct dev_node *dev)
         if (dev_bind_sock(dev->rx_mcast_sock, &dev->ifname_device) < 0)
                 return FAILURE;
 
+        dev_sock_timestamps(dev->rx_mcast_sock);
+
 
         struct sockaddr_storage rx_netwbrc_addr;
 
@@ -2516,6 +2532,8 @@ IDM_T dev_init_sockets(struct dev_node *dev)
                 if (dev_bind_sock(dev->rx_fullbrc_sock, &dev->ifname_device) < 0)
                         return FAILURE;
 
+                dev_sock_timestamps(dev->rx_fullbrc_sock);
+
 
                 // bind recv socket to address
                 if (bind(dev->rx_fullbrc_sock, (struct sockaddr *) & rx_fullbrc_addr, sizeof (rx_fullbrc_addr)) < 0) {
@@ -3861,6 +3879,7 @@ int32_t opt_dev(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_par
                         int i;
                         for (i = 0; i < FRAME_TYPE_ARRSZ; i++) {
                                 LIST_INIT_HEAD(dev->tx_task_lists[i], struct tx_task_node, list, list);
+                                LIST_INIT_HEAD(dev->tx_task_lndevs[i], struct link_dev_node, tx_task_lndev_nodes[i], key);
                         }
 
                         AVL_INIT_TREE(dev->tx_task_interval_tree, struct tx_task_node, task);
@@ -503,6 +503,7 @@ struct dev_node {
 	HELLO_SQN_T link_hello_sqn;
 
 	struct list_head tx_task_lists[FRAME_TYPE_ARRSZ]; // scheduled frames and messages
+	struct list_head tx_task_lndevs[FRAME_TYPE_ARRSZ]; // link_dev_nodes of this dev with (or recently with) tx_task_lists[] items
 	struct avl_tree tx_task_interval_tree;
 
 	int8_t announce;
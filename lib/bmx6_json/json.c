@@ -394,6 +394,32 @@ void json_links_event_hook(int32_t cb_id, void* data)
         }
 }
 
+STATIC_FUNC
+void json_memory_event_hook(int32_t cb_id, void* data)
+{
+        if (!json_update_interval || terminating || !avl_find_item(&status_tree, ARG_MEMORY))
+                return;
+
+        TRACE_FUNCTION_CALL;
+
+        int fd;
+        char path_name[MAX_PATH_SIZE + 20] = "";
+        sprintf(path_name, "%s/%s", json_dir, ARG_MEMORY);
+
+        if ((fd = open(path_name, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+
+                dbgf_sys(DBGT_ERR, "could not open %s - %s", path_name, strerror(errno));
+
+        } else {
+
+                struct ctrl_node *cn = create_ctrl_node(fd, NULL, YES/*we are root*/);
+
+                check_apply_parent_option(ADD, OPT_APPLY, 0, get_option(0, 0, ARG_JSON_STATUS), ARG_MEMORY, cn);
+
+                close_ctrl_node(CTRL_CLOSE_STRAIGHT, cn);
+        }
+}
+
 STATIC_FUNC
 void json_originator_event_hook(int32_t cb_id, struct orig_node *orig)
 {
@@ -598,6 +624,7 @@ void update_json_status(void *data)
         json_status_event_hook(0, NULL);
         json_dev_event_hook(0, NULL);
         json_links_event_hook(0, NULL);
+        json_memory_event_hook(0, NULL);
         json_originator_event_hook(PLUGIN_CB_DESCRIPTION_CREATED, NULL);
 }
 
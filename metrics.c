@@ -215,8 +215,8 @@ FMETRIC_U16_T umetric_to_fmetric(UMETRIC_T val)
 
 char *umetric_to_human(UMETRIC_T val) {
 #define UMETRIC_TO_HUMAN_ARRAYS 4
-        static char out[UMETRIC_TO_HUMAN_ARRAYS][12] = {{0},{0},{0},{0}};
-        static uint8_t p=0;
+        static __thread char out[UMETRIC_TO_HUMAN_ARRAYS][12] = {{0},{0},{0},{0}};
+        static __thread uint8_t p=0;
 
         if (val < UMETRIC_MIN__NOT_ROUTABLE) {
                 return "INVALID";
@@ -714,6 +714,12 @@ update_metric_error:
         if (on && on->curr_rt_local == rt && rec->umetric < on->path_metricalgo->umetric_min)
                 set_ogmSqn_toBeSend_and_aggregated(on, on->ogmMetric_next, on->ogmSqn_send, on->ogmSqn_send);
 
+        if (on && rec->umetric < UMETRIC_ROUTABLE)
+                schedule_orig_router_purge(on);
+
+        if (on && on->curr_rt_local == rt)
+                status_orig_changed(on);
+
         return ret;
 }
 
@@ -821,6 +827,8 @@ void lndev_assign_best(struct local_node *only_local, struct link_dev_node *only
 
                 local->best_lndev = (local->best_tp_lndev == local->best_rp_lndev) ? local->best_rp_lndev : NULL;
 
+                status_local_changed(local);
+
 
                 if(only_local)
                         break;
@@ -830,12 +838,13 @@ void lndev_assign_best(struct local_node *only_local, struct link_dev_node *only
 
 
 
-void update_link_probe_record(struct link_dev_node *lndev, HELLO_SQN_T sqn, uint8_t probe)
+void update_link_probe_record(struct link_dev_node *lndev, HELLO_SQN_T sqn, uint8_t probe, struct timespec *rx_stamp)
 {
 
         TRACE_FUNCTION_CALL;
         struct link_node *link = lndev->key.link;
         struct lndev_probe_record *lpr = &lndev->rx_probe_record;
+        TIME_T rx_time = get_rx_time(rx_stamp);
 
         ASSERTION(-501049, ((sizeof (((struct lndev_probe_record*) NULL)->hello_array)) * 8 == MAX_HELLO_SQN_WINDOW));
         assertion(-501050, (probe <= 1));
@@ -899,10 +908,10 @@ void update_link_probe_record(struct link_dev_node *lndev, HELLO_SQN_T sqn, uint
 
         lpr->hello_sqn_max = sqn;
         lpr->hello_umetric = (UMETRIC_MAX / my_link_window) * lpr->hello_sum;
-        lpr->hello_time_max = bmx_time;
+        lpr->hello_time_max = rx_time;
 
         link->hello_sqn_max = sqn;
-        link->hello_time_max = bmx_time;
+        link->hello_time_max = rx_time;
 
         lndev_assign_best(link->local, lndev);
 
@@ -972,6 +981,8 @@ IDM_T update_path_metrics(struct packet_buff *pb, struct orig_node *on, OGM_SQN_
 
         OGM_SQN_T ogm_sqn_max = UXX_GET_MAX(OGM_SQN_MASK, on->ogmSqn_maxRcvd, ogm_sqn);
 
+        status_orig_changed(on);
+
         dbgf_all(DBGT_INFO, "global_id=%s orig_sqn %d via neigh %s", globalIdAsString(&on->global_id), ogm_sqn, pb->i.llip_str);
 
 
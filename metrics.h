@@ -251,7 +251,7 @@ IDM_T fmetric_cmp(FMETRIC_U16_T a, unsigned char cmp, FMETRIC_U16_T b);
 
 UMETRIC_T apply_metric_algo(UMETRIC_T *tr, UMETRIC_T *umetric_max, const UMETRIC_T *path, struct host_metricalgo *algo);
 void lndev_assign_best(struct local_node *local, struct link_dev_node *lndev );
-void update_link_probe_record(struct link_dev_node *lndev, HELLO_SQN_T sqn, uint8_t probe);
+void update_link_probe_record(struct link_dev_node *lndev, HELLO_SQN_T sqn, uint8_t probe, struct timespec *rx_stamp);
 
 void metricalgo_remove(struct orig_node *on);
 void metricalgo_assign(struct orig_node *on, struct host_metricalgo *host_algo);
@@ -15,6 +15,7 @@
  * 02110-1301, USA
  */
 
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -74,6 +75,21 @@ TIME_T myIID4me_timestamp = 0;
 
 
 static PKT_SQN_T my_packet_sqn = 0;
+
+// packets assembled during one tx_packets() round, flushed per socket by tx_queue_flush()
+static struct tx_queue_node {
+        int32_t send_sock;
+        struct dev_node *oif;
+        struct sockaddr_storage dst;
+        uint16_t length;
+        uint16_t iov_num;
+        struct iovec iov[(2 * TX_PACKET_REFS_MAX) + 1]; // into data, or to referenced buffers at the holes of data
+        uint8_t data[MAX_UDPD_SIZE];
+} tx_queue[MAX_TX_BATCH_SIZE];
+static uint16_t tx_queue_items = 0;
+static IDM_T tx_sendmmsg_unsupported = NO;
+
+struct tx_batch_statistics tx_batch_stats;
 static IDM_T first_packet = YES;
 
 static struct msg_dev_adv *my_dev_adv_buff = NULL;
@@ -95,6 +111,11 @@ LIST_SIMPEL( ogm_aggreg_list, struct ogm_aggreg_node, list, sqn );
 uint32_t ogm_aggreg_pending = 0;
 static AGGREG_SQN_T ogm_aggreg_sqn_max;
 
+// one bit per myIID4orig whose originator may have an ogm pending, bits of no longer pending ones are cleared lazily
+#define OGM_PENDING_WORD_BITS 32
+static uint32_t *ogm_pending_bits = NULL;
+static uint32_t ogm_pending_words = 0;
+
 static struct dhash_node* DHASH_NODE_FAILURE = (struct dhash_node*) & DHASH_NODE_FAILURE;
 
 
@@ -356,6 +377,36 @@ void purge_tx_task_list(struct list_head *tx_task_lists, struct link_node *only_
 }
 
 
+/*
+ * Each dev indexes, per frame type, the link_dev_nodes whose tx_task_lists[] of that type got items, so that
+ * tx_packet_assemble() does not need to walk the whole link_tree. Lndevs are linked by tx_task_new() and
+ * unlinked lazily by next_tx_task_list() once their list is found empty, or here before an lndev is freed.
+ */
+void purge_tx_task_lndev(struct link_dev_node *lndev)
+{
+        TRACE_FUNCTION_CALL;
+        int i;
+
+        for (i = 0; i < FRAME_TYPE_ARRSZ; i++) {
+
+                struct list_head *lndevs = &lndev->key.dev->tx_task_lndevs[i];
+                struct list_node *lprev = (struct list_node*) lndevs;
+
+                if (!(lndev->tx_task_lndevs_listed & (((uint32_t) 1) << i)))
+                        continue;
+
+                while (lprev->next != &lndev->tx_task_lndev_nodes[i]) {
+                        assertion(-501634, (lprev->next != (struct list_node*) lndevs));
+                        lprev = lprev->next;
+                }
+
+                list_del_next(lndevs, lprev);
+        }
+
+        lndev->tx_task_lndevs_listed = 0;
+}
+
+
 STATIC_FUNC
 IDM_T freed_tx_task_node(struct tx_task_node *tx_task, struct list_head *tx_task_list, struct list_node *lprev)
 {
@@ -406,9 +457,12 @@ IDM_T tx_task_obsolete(struct tx_task_node *tx_task)
 //                tx_task->send_ts = bmx_time;
 
                 self->dhn->referred_by_me_timestamp = bmx_time;
+                status_orig_changed(self);
 
-                if (dhn)
+                if (dhn) {
                         dhn->referred_by_me_timestamp = bmx_time;
+                        status_orig_changed(dhn->on);
+                }
 
                 return TLV_TX_DATA_PROCESSED;
         }
@@ -481,6 +535,13 @@ struct tx_task_node *tx_task_new(struct link_dev_node *dest_lndev, struct tx_tas
 
                 list_add_tail(&(dest_lndev->tx_task_lists[test->task.type]), &ttn->list);
 
+                if (!(dest_lndev->tx_task_lndevs_listed & (((uint32_t) 1) << test->task.type))) {
+
+                        dest_lndev->tx_task_lndevs_listed |= (((uint32_t) 1) << test->task.type);
+                        list_add_tail(&(dest_lndev->key.dev->tx_task_lndevs[test->task.type]),
+                                &(dest_lndev->tx_task_lndev_nodes[test->task.type]));
+                }
+
                 dbgf_track(DBGT_INFO, "added %s to lndev local_id=%X link_ip=%s dev=%s tx_tasks_list.items=%d",
                         handl->name, ntohl(dest_lndev->key.link->key.local_id),
                         ipFAsStr(&dest_lndev->key.link->link_ip),
@@ -590,6 +651,58 @@ void schedule_tx_task(struct link_dev_node *dest_lndev, uint16_t frame_type, int
 
 
 
+/*
+ * Marks the IID of an originator with a pending ogm so create_ogm_aggregation() only visits marked IIDs.
+ * Must be called whenever on->ogmSqn_next gets ahead of on->ogmSqn_send or on->dhn changes.
+ */
+void ogm_pending_mark(struct orig_node *on)
+{
+        if (!on->dhn || !UXX_GT(OGM_SQN_MASK, on->ogmSqn_next, on->ogmSqn_send))
+                return;
+
+        uint32_t iid = on->dhn->myIID4orig;
+
+        if (iid / OGM_PENDING_WORD_BITS >= ogm_pending_words) {
+
+                uint32_t words = XMAX(my_iid_repos.arr_size, iid + 1) / OGM_PENDING_WORD_BITS + 1;
+
+                ogm_pending_bits = debugRealloc(ogm_pending_bits, words * sizeof (uint32_t), -300604);
+                memset(&ogm_pending_bits[ogm_pending_words], 0, (words - ogm_pending_words) * sizeof (uint32_t));
+                ogm_pending_words = words;
+        }
+
+        ogm_pending_bits[iid / OGM_PENDING_WORD_BITS] |= (((uint32_t) 1) << (iid % OGM_PENDING_WORD_BITS));
+}
+
+STATIC_INLINE_FUNC
+void ogm_pending_clear(uint32_t iid)
+{
+        ogm_pending_bits[iid / OGM_PENDING_WORD_BITS] &= ~(((uint32_t) 1) << (iid % OGM_PENDING_WORD_BITS));
+}
+
+// returns the first marked IID >= iid, or my_iid_repos.max_free if there is none
+STATIC_INLINE_FUNC
+uint32_t ogm_pending_next(uint32_t iid)
+{
+        uint32_t w = iid / OGM_PENDING_WORD_BITS;
+        uint32_t bits;
+
+        if (w >= ogm_pending_words)
+                return my_iid_repos.max_free;
+
+        bits = ogm_pending_bits[w] & ((~((uint32_t) 0)) << (iid % OGM_PENDING_WORD_BITS));
+
+        while (!bits) {
+
+                if (++w >= ogm_pending_words)
+                        return my_iid_repos.max_free;
+
+                bits = ogm_pending_bits[w];
+        }
+
+        return (w * OGM_PENDING_WORD_BITS) + __builtin_ctz(bits);
+}
+
 OGM_SQN_T set_ogmSqn_toBeSend_and_aggregated(struct orig_node *on, UMETRIC_T um, OGM_SQN_T to_be_send, OGM_SQN_T aggregated)
 {
         TRACE_FUNCTION_CALL;
@@ -614,6 +727,10 @@ OGM_SQN_T set_ogmSqn_toBeSend_and_aggregated(struct orig_node *on, UMETRIC_T um,
         on->ogmSqn_next = to_be_send;
         on->ogmSqn_send = aggregated;
 
+        ogm_pending_mark(on);
+
+        status_orig_changed(on);
+
         return on->ogmSqn_next;
 }
 
@@ -665,19 +782,24 @@ void create_ogm_aggregation(void)
         struct msg_ogm_adv* msgs =
                 debugMalloc((target_ogms + OGM_JUMPS_PER_AGGREGATION) * sizeof (struct msg_ogm_adv), -300177);
 
-        IID_T curr_iid;
+        uint32_t curr_iid;
         IID_T ogm_iid = 0;
         IID_T ogm_iid_jumps = 0;
         uint16_t ogm_msg = 0;
 
         dbgf_all(DBGT_INFO, "pending %d target %d", ogm_aggreg_pending, target_ogms);
 
-        for (curr_iid = IID_MIN_USED; curr_iid < my_iid_repos.max_free; curr_iid++) {
+        // visit marked IIDs in ascending order, as a scan of my_iid_repos would, to keep IID jumps rare:
+        for (curr_iid = ogm_pending_next(IID_MIN_USED); curr_iid < my_iid_repos.max_free; curr_iid = ogm_pending_next(curr_iid + 1)) {
 
                 IID_NODE_T *dhn = my_iid_repos.arr.node[curr_iid];
                 struct orig_node *on = dhn ? dhn->on : NULL;
 
-                if (on && UXX_GT(OGM_SQN_MASK, on->ogmSqn_next, on->ogmSqn_send)) {
+                if (!on || !UXX_GT(OGM_SQN_MASK, on->ogmSqn_next, on->ogmSqn_send)) {
+
+                        ogm_pending_clear(curr_iid);
+
+                } else {
 
                         if (on != self && (!on->curr_rt_local || on->curr_rt_local->mr.umetric < on->path_metricalgo->umetric_min)) {
 
@@ -710,12 +832,14 @@ void create_ogm_aggregation(void)
 
                         ogm_iid = create_ogm(on, ogm_iid, &msgs[ogm_msg + ogm_iid_jumps]);
 
+                        ogm_pending_clear(curr_iid);
+
                         if ((++ogm_msg) == target_ogms)
                                 break;
                 }
         }
 
-        assertion(-500817, (IMPLIES(curr_iid == my_iid_repos.max_free, !ogm_aggreg_pending)));
+        assertion(-500817, (IMPLIES(curr_iid >= my_iid_repos.max_free, !ogm_aggreg_pending)));
 
         if (ogm_aggreg_pending) {
                 dbgf_sys(DBGT_WARN, "%d ogms left for immediate next aggregation", ogm_aggreg_pending);
@@ -1161,7 +1285,7 @@ int32_t tx_msg_description_adv(struct tx_frame_iterator *it)
         adv->transmitterIID4x = htons(ttn->task.myIID4x);
         desc0 = dhn->on->desc;
 
-        memcpy((char*) & adv->desc, (char*) desc0, sizeof (struct description) + tlvs_len);
+        tx_iterator_cache_ref(it, (uint8_t*) & adv->desc, desc0, sizeof (struct description) + tlvs_len);
 
         dbgf_track(DBGT_INFO, "id=%s descr_size=%zu", globalIdAsString(&dhn->on->global_id), (tlvs_len + sizeof (struct msg_description_adv)));
 
@@ -1417,6 +1541,8 @@ void set_link_adv_msg(uint16_t msg, struct link_dev_node *lndev)
         
         if (lndev->key.link->local->link_adv_msg_for_him == LINKADV_MSG_IGNORED)
                 lndev->key.link->local->link_adv_msg_for_him = msg;
+
+        status_local_changed(lndev->key.link->local);
 }
 
 void update_my_link_adv(uint32_t changes)
@@ -1794,7 +1920,7 @@ int32_t tx_frame_ogm_advs(struct tx_frame_iterator *it)
                 if (oan->ogm_dest_bytes)
                         memcpy(tx_iterator_cache_msg_ptr(it), oan->ogm_dest_field, oan->ogm_dest_bytes);
 
-                memcpy(tx_iterator_cache_msg_ptr(it) + oan->ogm_dest_bytes, oan->ogm_advs, msgs_length);
+                tx_iterator_cache_ref(it, tx_iterator_cache_msg_ptr(it) + oan->ogm_dest_bytes, oan->ogm_advs, msgs_length);
 
                 return ttn->frame_msgs_length;
         }
@@ -2477,7 +2603,7 @@ int32_t rx_msg_hello_adv(struct rx_frame_iterator *it)
                         packet_frame_handler[FRAME_TYPE_HELLO_ADV].name, it->frame_msgs_length);
         }
 
-        update_link_probe_record(pb->i.lndev, hello_sqn, 1);
+        update_link_probe_record(pb->i.lndev, hello_sqn, 1, &pb->i.tv_stamp);
 
 	// check if this link is currently ignored in our link_adv frames but
 	// is actually a reasonable good link which should be included so that
@@ -2859,51 +2985,160 @@ IDM_T rx_frames(struct packet_buff *pb)
 
 
 STATIC_FUNC
-int8_t send_udp_packet(struct packet_buff *pb, struct sockaddr_storage *dst, int32_t send_sock)
+void tx_queue_error(struct tx_queue_node *tqn)
+{
+        if (errno == 1) {
+
+                dbg_mute(60, DBGL_SYS, DBGT_ERR, "can't send: %s. Does firewall accept %s dev=%s port=%i ?",
+                        strerror(errno), family2Str(((struct sockaddr_in*) &tqn->dst)->sin_family),
+                        tqn->oif->ifname_label.str, ntohs(((struct sockaddr_in*) &tqn->dst)->sin_port));
+
+        } else {
+
+                dbg_mute(60, DBGL_SYS, DBGT_ERR, "can't send via fd=%d dev=%s : %s",
+                        tqn->send_sock, tqn->oif->ifname_label.str, strerror(errno));
+        }
+}
+
+/*
+ * Sends the queued packets of consecutive queue entries sharing the same socket with one sendmmsg() call.
+ * Kernels without sendmmsg() (ENOSYS) get one sendmsg() per packet.
+ */
+STATIC_FUNC
+void tx_queue_flush(void)
 {
         TRACE_FUNCTION_CALL;
-	int status;
+
+        struct mmsghdr msgs[MAX_TX_BATCH_SIZE];
+        uint16_t i, n, sent;
+
+        for (i = 0; i < tx_queue_items; i++) {
+                memset(&msgs[i], 0, sizeof (msgs[i]));
+                msgs[i].msg_hdr.msg_name = &tx_queue[i].dst;
+                msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+                msgs[i].msg_hdr.msg_iov = tx_queue[i].iov;
+                msgs[i].msg_hdr.msg_iovlen = tx_queue[i].iov_num;
+        }
+
+        for (i = 0; i < tx_queue_items; i += n) {
+
+                int32_t send_sock = tx_queue[i].send_sock;
+
+                for (n = 1; i + n < tx_queue_items && tx_queue[i + n].send_sock == send_sock; n++);
+
+                for (sent = 0; sent < n;) {
+
+                        int status;
+
+                        if (!tx_sendmmsg_unsupported) {
+
+                                status = sendmmsg(send_sock, &msgs[i + sent], n - sent, 0);
+
+                                if (status < 0 && errno == ENOSYS) {
+                                        dbgf_sys(DBGT_WARN, "sendmmsg() not supported, falling back to sendto()");
+                                        tx_sendmmsg_unsupported = YES;
+                                        continue;
+                                }
+
+                        } else {
+
+                                status = sendmsg(send_sock, &msgs[i + sent].msg_hdr, 0);
+
+                                status = status < 0 ? status : 1;
+                        }
+
+                        tx_batch_stats.syscalls++;
+
+                        if (status <= 0) {
+                                // skip the failing packet and retry with the remaining ones
+                                tx_queue_error(&tx_queue[i + sent]);
+                                status = 1;
+                        }
+
+                        sent += status;
+                }
+        }
+
+        tx_batch_stats.packets += tx_queue_items;
+        tx_queue_items = 0;
+}
+
+/*
+ * Queues the packet in pb for tx_queue_flush(). Only the bytes written into pb are copied, the data of refs
+ * (positioned after the packet header) fills the holes they left and is sent from where it is.
+ */
+STATIC_FUNC
+void send_udp_packet(struct packet_buff *pb, struct tx_packet_ref *refs, int32_t refs_num, struct sockaddr_storage *dst, int32_t send_sock)
+{
+        TRACE_FUNCTION_CALL;
+        int32_t i, pos, end;
 
         dbgf_all(DBGT_INFO, "len=%d via dev=%s", pb->i.total_length, pb->i.oif->ifname_label.str);
 
 	if ( send_sock == 0 )
-		return 0;
+		return;
 
-	/*
-        static struct iovec iov;
-        iov.iov_base = udp_data;
-        iov.iov_len  = udp_data_len;
+        assertion(-501581, (pb->i.total_length <= MAX_UDPD_SIZE));
 
-        static struct msghdr m = { 0, sizeof( *dst ), &iov, 1, NULL, 0, 0 };
-        m.msg_name = dst;
+        if (tx_queue_items >= MAX_TX_BATCH_SIZE)
+                tx_queue_flush();
 
-        status = sendmsg( send_sock, &m, 0 );
-         */
+        struct tx_queue_node *tqn = &tx_queue[tx_queue_items++];
 
-        status = sendto(send_sock, pb->packet.data, pb->i.total_length, 0, (struct sockaddr *) dst, sizeof (struct sockaddr_storage));
+        tqn->send_sock = send_sock;
+        tqn->oif = pb->i.oif;
+        tqn->dst = *dst;
+        tqn->length = pb->i.total_length;
+        tqn->iov_num = 0;
 
-	if ( status < 0 ) {
+        for (i = 0, pos = 0; i <= refs_num; i++) {
 
-		if ( errno == 1 ) {
+                end = (i < refs_num) ? (int32_t) (refs[i].pos + sizeof (struct packet_header)) : pb->i.total_length;
 
-                        dbg_mute(60, DBGL_SYS, DBGT_ERR, "can't send: %s. Does firewall accept %s dev=%s port=%i ?",
-                                strerror(errno), family2Str(((struct sockaddr_in*) dst)->sin_family),
-                                pb->i.oif->ifname_label.str ,ntohs(((struct sockaddr_in*) dst)->sin_port));
+                assertion(-501637, (end >= pos && end <= pb->i.total_length));
 
-		} else {
+                if (end > pos) {
+                        memcpy(tqn->data + pos, pb->packet.data + pos, end - pos);
+                        tqn->iov[tqn->iov_num].iov_base = tqn->data + pos;
+                        tqn->iov[tqn->iov_num++].iov_len = end - pos;
+                }
 
-                        dbg_mute(60, DBGL_SYS, DBGT_ERR, "can't send via fd=%d dev=%s : %s",
-                                send_sock, pb->i.oif->ifname_label.str, strerror(errno));
+                if (i < refs_num) {
+                        tqn->iov[tqn->iov_num].iov_base = (void*) refs[i].data;
+                        tqn->iov[tqn->iov_num++].iov_len = refs[i].len;
+                        pos = end + refs[i].len;
+                }
+        }
+}
 
-		}
 
-		return -1;
-	}
 
-	return 0;
-}
 
+/*
+ * Lets a tx handler contribute len bytes of already serialized data at cache_ptr by reference instead of copying
+ * them into the cache and from there into the packet. The data must stay unchanged until the packet is sent
+ * with the tx_queue_flush() at the end of the current tx_packets() or tx_packet() call.
+ * Falls back to copying for small data, when refs are exhausted, or if the iterator has none.
+ */
+void tx_iterator_cache_ref(struct tx_frame_iterator *it, uint8_t *cache_ptr, const void *data, int32_t len)
+{
+        struct tx_packet_ref *ref;
+        int32_t pos = cache_ptr - it->cache_data_array;
 
+        if (!it->refs || len < TX_PACKET_REF_MIN || it->refs_num >= TX_PACKET_REFS_MAX) {
+                memcpy(cache_ptr, data, len);
+                return;
+        }
+
+        assertion(-501638, (pos >= 0 && len <= it->frames_out_max - it->frames_out_pos - pos));
+        assertion(-501639, (IMPLIES(it->refs_num > it->refs_frames,
+                pos >= it->refs[it->refs_num - 1].pos + it->refs[it->refs_num - 1].len)));
+
+        ref = &it->refs[it->refs_num++];
+        ref->pos = pos;
+        ref->len = len;
+        ref->data = data;
+}
 
 
 /*
@@ -3025,73 +3260,117 @@ int32_t tx_frame_iterate(IDM_T iterate_msg, struct tx_frame_iterator *it)
         fhs->is_relevant = handl->is_relevant;
         fhs->type = t;
 
-        memcpy(it->frames_out_ptr + it->frames_out_pos, it->cache_data_array, cache_pos);
+        // copy (and clear) the cache around referenced data, which is left as hole in frames_out:
+        int32_t r, copied = 0;
+
+        for (r = it->refs_frames; r <= it->refs_num; r++) {
+
+                int32_t end = (r < it->refs_num) ? it->refs[r].pos : cache_pos;
+
+                memcpy(it->frames_out_ptr + it->frames_out_pos + copied, it->cache_data_array + copied, end - copied);
+                memset(it->cache_data_array + copied, 0, end - copied);
+
+                if (r < it->refs_num) {
+                        copied = end + it->refs[r].len;
+                        it->refs[r].pos += it->frames_out_pos;
+                }
+        }
+
+        it->refs_frames = it->refs_num;
         it->frames_out_pos += cache_pos;
         it->frames_out_num++;
 
         dbgf_all(DBGT_INFO, "added %s frame_header type=%s frame_data_length=%d frame_msgs_length=%d",
                 is_short_header ? "SHORT" : "LONG", handl->name, cache_pos, tlv_result);
 
-        memset(it->cache_data_array, 0, tlv_result + handl->data_header_size);
         it->cache_msgs_size = 0;
 
         return tlv_result;
 }
 
 
+/*
+ * Selects the next tx_task_list to be processed for dev: for each frame type first the lists of the lndevs
+ * indexed in dev->tx_task_lndevs[], then the one of dev itself. *lndev_prev remembers the predecessor of the
+ * currently processed lndev in that index (NULL while processing the list of dev) so that lndevs whose list
+ * turned out empty can be unlinked on the way.
+ */
 STATIC_FUNC
-void next_tx_task_list(struct dev_node *dev, struct tx_frame_iterator *it, struct avl_node **link_tree_iterator)
+void next_tx_task_list(struct dev_node *dev, struct tx_frame_iterator *it, struct list_node **lndev_prev)
 {
         TRACE_FUNCTION_CALL;
 
-        struct link_node *link = NULL;
+        struct list_head *lndevs;
+        struct list_node *lprev;
+        struct link_dev_node *lndev;
 
         if (it->tx_task_list && it->tx_task_list->items &&
                 ((struct tx_task_node*) (list_get_last(it->tx_task_list)))->considered_ts != bmx_time) {
                 return;
         }
 
-        if (it->tx_task_list == &(dev->tx_task_lists[it->frame_type]))
+        if (it->tx_task_list == &(dev->tx_task_lists[it->frame_type])) {
                 it->frame_type++;
+                *lndev_prev = NULL;
+        }
 
-        while ((link = avl_iterate_item(&link_tree, link_tree_iterator))) {
-                struct list_node *lndev_pos;
-                struct link_dev_node *lndev = NULL;
+        lndevs = &(dev->tx_task_lndevs[it->frame_type]);
 
-                list_for_each(lndev_pos, &link->lndev_list)
-                {
-                        lndev = list_entry(lndev_pos, struct link_dev_node, list);
+        if (!(lprev = *lndev_prev)) {
 
-                        if (lndev->key.dev == dev && lndev->tx_task_lists[it->frame_type].items) {
+                lprev = (struct list_node*) lndevs;
 
-                                assertion(-500866, (lndev->key.link == link));
+        } else {
 
-                                it->tx_task_list = &(lndev->tx_task_lists[it->frame_type]);
+                assertion(-501635, (lprev->next != (struct list_node*) lndevs));
 
-                                dbgf_track(DBGT_INFO,
-                                        "found %s   link nb: nb_local_id=%X nb_dev_idx=%d nbIP=%s   via lndev: my_dev=%s my_dev_idx=%d with lndev->tx_tasks_list[].items=%d",
-                                        it->handls[it->frame_type].name,
-                                        ntohl(link->key.local_id), link->key.dev_idx, ipFAsStr(&link->link_ip),
-                                        dev->ifname_label.str, dev->llip_key.idx, it->tx_task_list->items);
+                lndev = list_entry(lprev->next, struct link_dev_node, tx_task_lndev_nodes[it->frame_type]);
 
-                                return;
-                        }
+                if (lndev->tx_task_lists[it->frame_type].items) {
+                        lprev = lprev->next;
+                } else {
+                        lndev->tx_task_lndevs_listed &= ~(((uint32_t) 1) << it->frame_type);
+                        list_del_next(lndevs, lprev);
                 }
         }
 
-        *link_tree_iterator = NULL;
+        while (lprev->next != (struct list_node*) lndevs) {
+
+                lndev = list_entry(lprev->next, struct link_dev_node, tx_task_lndev_nodes[it->frame_type]);
+
+                assertion(-500866, (lndev->key.dev == dev));
+
+                if (lndev->tx_task_lists[it->frame_type].items) {
+
+                        *lndev_prev = lprev;
+                        it->tx_task_list = &(lndev->tx_task_lists[it->frame_type]);
+
+                        dbgf_track(DBGT_INFO,
+                                "found %s   link nb: nb_local_id=%X nb_dev_idx=%d nbIP=%s   via lndev: my_dev=%s my_dev_idx=%d with lndev->tx_tasks_list[].items=%d",
+                                it->handls[it->frame_type].name,
+                                ntohl(lndev->key.link->key.local_id), lndev->key.link->key.dev_idx, ipFAsStr(&lndev->key.link->link_ip),
+                                dev->ifname_label.str, dev->llip_key.idx, it->tx_task_list->items);
+
+                        return;
+                }
+
+                lndev->tx_task_lndevs_listed &= ~(((uint32_t) 1) << it->frame_type);
+                list_del_next(lndevs, lprev);
+        }
+
+        *lndev_prev = NULL;
         it->tx_task_list = &(dev->tx_task_lists[it->frame_type]);
         return;
 }
 
 STATIC_FUNC
-void tx_packet(void *devp)
+void tx_packet_assemble(struct dev_node *dev)
 {
         TRACE_FUNCTION_CALL;
 
         static uint8_t cache_data_array[MAX_UDPD_SIZE] = {0};
+        static struct tx_packet_ref refs[TX_PACKET_REFS_MAX];
         static struct packet_buff pb;
-        struct dev_node *dev = devp;
 
         assertion(-500204, (dev));
 
@@ -3122,14 +3401,14 @@ void tx_packet(void *devp)
                 .frames_out_max = (MAX_UDPD_SIZE - sizeof (struct packet_header)),
                 .frames_out_pref = (pref_udpd_size - sizeof (struct packet_header)),
                 .cache_data_array = cache_data_array, .cache_msgs_size = 0,
-                .frame_type = 0, .tx_task_list = NULL
+                .frame_type = 0, .tx_task_list = NULL, .refs = refs
         };
 
-        struct avl_node *link_tree_iterator = NULL;
+        struct list_node *lndev_prev = NULL;
 
         while (it.frame_type < FRAME_TYPE_NOP) {
 
-                next_tx_task_list(dev, &it, &link_tree_iterator);
+                next_tx_task_list(dev, &it, &lndev_prev);
 
                 struct list_node *lpos, *ltmp, *lprev = (struct list_node*) it.tx_task_list;
                 int32_t tlv_result = TLV_TX_DATA_DONE;
@@ -3264,9 +3543,18 @@ void tx_packet(void *devp)
                         packet_hdr->local_id = my_local_id;
                         packet_hdr->dev_idx = dev->llip_key.idx;
 
+                        assertion(-501640, (it.refs_frames == it.refs_num));
+
+                        // packet hooks see the packet as sent:
+                        if (it.refs_num && has_packet_hooks()) {
+                                int32_t r;
+                                for (r = 0; r < it.refs_num; r++)
+                                        memcpy(it.frames_out_ptr + refs[r].pos, refs[r].data, refs[r].len);
+                        }
+
                         cb_packet_hooks(&pb);
 
-                        send_udp_packet(&pb, &dev->tx_netwbrc_addr, dev->unicast_sock);
+                        send_udp_packet(&pb, refs, it.refs_num, &dev->tx_netwbrc_addr, dev->unicast_sock);
 
                         dbgf_all(DBGT_INFO, "send packet size=%d  via dev=%s",
                                 pb.i.total_length, dev->ifname_label.str);
@@ -3275,6 +3563,8 @@ void tx_packet(void *devp)
 
                         it.frames_out_pos = 0;
                         it.frames_out_num = 0;
+                        it.refs_num = 0;
+                        it.refs_frames = 0;
 
                 }
 
@@ -3283,6 +3573,12 @@ void tx_packet(void *devp)
         assertion(-500797, (!it.frames_out_pos));
 }
 
+void tx_packet(void *devp)
+{
+        tx_packet_assemble((struct dev_node *) devp);
+        tx_queue_flush();
+}
+
 void tx_packets( void *unused ) {
 
         TRACE_FUNCTION_CALL;
@@ -3325,7 +3621,7 @@ void tx_packets( void *unused ) {
 
                         } else if (dev->linklayer == TYP_DEV_LL_LAN) {
 
-                                tx_packet(dev);
+                                tx_packet_assemble(dev);
 
                         } else {
                                 dev->tx_task = tx_packet;
@@ -3335,6 +3631,9 @@ void tx_packets( void *unused ) {
                         }
                 }
         }
+
+        tx_queue_flush();
+
 	first_packet = NO;
 }
 
@@ -3735,6 +4034,7 @@ int32_t init_msg( void )
 {
 	assertion(-501567, (FRAME_TYPE_MASK >= FRAME_TYPE_MAX_KNOWN));
 	assertion(-501568, (FRAME_TYPE_MASK >= BMX_DSC_TLV_MAX_KNOWN));
+	assertion(-501636, (FRAME_TYPE_ARRSZ <= 8 * sizeof (((struct link_dev_node*) NULL)->tx_task_lndevs_listed)));
 
         assertion(-500347, (sizeof (struct description_hash) == HASH_SHA1_LEN));
         assertion(-501146, (OGM_DEST_ARRAY_BIT_SIZE == ((OGM_DEST_ARRAY_BIT_SIZE / 8)*8)));
@@ -3921,6 +4221,12 @@ void cleanup_msg( void )
 {
         schedule_or_purge_ogm_aggregations(YES /*purge_all*/);
 
+        if (ogm_pending_bits)
+                debugFree(ogm_pending_bits, -300605);
+
+        ogm_pending_bits = NULL;
+        ogm_pending_words = 0;
+
         if (lndev_arr)
                 debugFree(lndev_arr, -300218);
         
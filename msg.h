@@ -30,6 +30,17 @@
 #define MAX_UDPD_SIZE (XMIN( 1400, MAX_PACKET_SIZE))
 #define ARG_UDPD_SIZE "udpDataSize"
 
+#define MAX_TX_BATCH_SIZE 32
+#define TX_PACKET_REFS_MAX 16 // referenced (not copied) buffers per packet, see tx_iterator_cache_ref()
+#define TX_PACKET_REF_MIN  64 // smaller data is cheaper to copy than to send as separate iovec
+
+struct tx_batch_statistics {
+        uint32_t packets;
+        uint32_t syscalls;
+};
+
+extern struct tx_batch_statistics tx_batch_stats;
+
 
 
 #define DEF_TX_TS_TREE_SIZE 150
@@ -319,6 +330,12 @@ struct rx_frame_iterator {
  * this iterator is given a fr_type and a set of handlers,
  * then the handlers are supposed to figure out what needs to be done.
  * finally the iterator writes ready-to-send frame_header and frame data to *fs_data */
+struct tx_packet_ref {
+	int32_t pos; // offset in cache_data_array until its frame is added, then in frames_out_ptr
+	int32_t len;
+	const uint8_t *data;
+};
+
 struct tx_frame_iterator {
 	// MUST be initialized:
 	// remains unchanged:
@@ -332,6 +349,7 @@ struct tx_frame_iterator {
 	uint8_t              handl_max;
 	int32_t              frames_out_pref;
 	int32_t              frames_out_max;
+	struct tx_packet_ref *refs; // TX_PACKET_REFS_MAX, or NULL if frames_out must be contiguous
 
         // updated by fs_caller():
 	uint8_t              frame_type;
@@ -340,6 +358,8 @@ struct tx_frame_iterator {
 	int32_t              frames_out_pos;
 	int32_t              frames_out_num;
 	int32_t              cache_msgs_size;
+	int32_t              refs_num;    // refs[refs_frames .. refs_num-1] still refer to the cache
+	int32_t              refs_frames;
 
 //#define tx_iterator_cache_data_space( it ) (((it)->frames_out_max) - ((it)->frames_out_pos + (it)->cache_msg_pos + ((int)(sizeof (struct frame_header_long)))))
 //#define tx_iterator_cache_hdr_ptr( it ) ((it)->cache_data_array)
@@ -407,6 +427,8 @@ static inline int32_t tx_iterator_cache_data_space_pref(struct tx_frame_iterator
 		(int) sizeof(struct frame_header_long));
 }
 
+void tx_iterator_cache_ref(struct tx_frame_iterator *it, uint8_t *cache_ptr, const void *data, int32_t len);
+
 static inline int32_t tx_iterator_cache_msg_space_max(struct tx_frame_iterator *it)
 {
         if (it->handls[it->frame_type].min_msg_size && it->handls[it->frame_type].fixed_msg_size)
@@ -740,6 +762,7 @@ extern Sha bmx_sha;
 ************************************************************/
 
 
+void ogm_pending_mark(struct orig_node *on);
 OGM_SQN_T set_ogmSqn_toBeSend_and_aggregated(struct orig_node *on, UMETRIC_T um, OGM_SQN_T to_be_send, OGM_SQN_T aggregated);
 void update_my_description_adv( void );
 void update_my_dev_adv(void);
@@ -750,7 +773,9 @@ IDM_T process_description_tlvs(struct packet_buff *pb, struct orig_node *on, str
         uint8_t filter, void *custom_data, struct ctrl_node *cn);
 void cache_desc_tlv_hashes(uint8_t op, struct orig_node *on, int8_t t_start, int8_t t, uint8_t *t_data, int32_t t_data_len);
 void purge_tx_task_list(struct list_head *tx_tasks_list, struct link_node *only_link, struct dev_node *only_dev);
+void purge_tx_task_lndev(struct link_dev_node *lndev);
 
+void tx_packet( void *devp );
 void tx_packets( void *unused );
 IDM_T rx_frames(struct packet_buff *pb);
 int32_t rx_frame_iterate(struct rx_frame_iterator* it);
@@ -124,6 +124,9 @@ void cb_route_change_hooks(uint8_t del, struct orig_node *dest)
 
         local_router->orig_routes = local_router->orig_routes + (del ? -1 : +1);
 
+        status_orig_changed(dest);
+        status_local_changed(local_router);
+
         assertion(-501320, (local_router->orig_routes >= 0 && local_router->orig_routes < (int) orig_tree.items));
 
 	list_for_each( list_pos, &cb_route_change_list ) {
@@ -173,9 +176,17 @@ void cb_packet_hooks(struct packet_buff *pb)
 
 }
 
+IDM_T has_packet_hooks(void)
+{
+        return cb_packet_list.items ? YES : NO;
+}
+
 
 void set_fd_hook( int32_t fd, void (*cb_fd_handler) (int32_t fd), int8_t del ) {
 
+        if (del)
+                fd_event_close(fd);
+
         _set_thread_hook(fd, (void (*) (void)) cb_fd_handler, del, (struct list_node*) & cb_fd_list);
 
 	change_selects();
@@ -99,6 +99,7 @@ struct cb_packet_node {
 
 void set_packet_hook(void (*cb_packet_handler) (struct packet_buff *), int8_t del);
 void cb_packet_hooks(struct packet_buff *pb);
+IDM_T has_packet_hooks(void);
 
 
 
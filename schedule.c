@@ -15,6 +15,7 @@
  * 02110-1301, USA
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -22,6 +23,9 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <linux/if.h>     // ifr_if, ifr_tun
 #include <linux/rtnetlink.h>
 
@@ -31,16 +35,55 @@
 #include "ip.h"
 #include "plugin.h"
 #include "schedule.h"
+#include "tools.h"
 
+#define CODE_CATEGORY_NAME "schedule"
 
 
 
-static LIST_SIMPEL( task_list, struct task_node, list, list );
 
-static int32_t receive_max_sock = 0;
-static fd_set receive_wait_set;
+static AVL_TREE(task_tree, struct task_node, key);
+static struct task_node **task_heap = NULL;
+static uint32_t task_heap_items = 0;
+static uint32_t task_heap_size = 0;
+static uint32_t task_sqn = 0;
+static struct task_node **task_expired = NULL; // tasks detached by the current expiry pass, in deadline order
+static uint32_t task_expired_items = 0;
+static uint32_t task_expired_size = 0;
+
+static int32_t epoll_fd = 0;
+static int32_t timer_fd = 0;
 
 static uint16_t changed_readfds = 1;
+static uint16_t fd_event_generation = 0;
+
+struct fd_event_node {
+	int32_t fd;
+	void (*fd_handler) (int32_t fd, void *data); // NULL if unregistered while events may still refer to it
+	void *data;
+	const char *name; // for profiling
+	uint16_t generation;
+};
+
+static AVL_TREE(fd_event_tree, struct fd_event_node, fd);
+static struct fd_event_node *fd_event_dispatched = NULL; // whose fd_handler is currently executed
+static LIST_SIMPEL(fd_event_zombie_plist, struct plist_node, list, list);
+
+static int32_t rx_batch_size = DEF_RX_BATCH_SIZE;
+
+struct rx_batch_statistics rx_batch_stats;
+
+static int32_t rx_budget_packets = DEF_RX_BUDGET_PACKETS;
+static int32_t rx_budget_time = DEF_RX_BUDGET_TIME;
+static uint32_t rx_round_packets = 0;
+static uint64_t rx_round_deadline_us = 0;
+static IDM_T rx_round_yielded = NO;
+static int32_t rx_round_resume_fd = -1; // first ready fd skipped by the last round, dispatched first by the next one
+
+struct tx_drift_statistics tx_drift_stats;
+
+static int32_t profiling = DEF_PROFILING;
+static AVL_TREE(profile_tree, struct profile_node, func);
 
 
 
@@ -49,109 +92,544 @@ void change_selects(void)
 	changed_readfds++;	
 }
 
+
+STATIC_FUNC
+uint64_t profile_time_us(void)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (((uint64_t) now.tv_sec) * 1000000) + (now.tv_nsec / 1000);
+}
+
+// absolute CLOCK_MONOTONIC time of the given bmx_time, comparable with profile_time_us()
+STATIC_FUNC
+uint64_t task_deadline_us(TIME_T t)
+{
+        struct timespec ts;
+
+        get_monotonic_time(t, &ts);
+
+        return (((uint64_t) ts.tv_sec) * 1000000) + (ts.tv_nsec / 1000);
+}
+
+STATIC_FUNC
+IDM_T rx_budget_exhausted(void)
+{
+        return rx_round_packets >= (uint32_t) rx_budget_packets || profile_time_us() >= rx_round_deadline_us;
+}
+
+STATIC_FUNC
+void tx_drift_update(TIME_T expire)
+{
+        uint64_t now_us = profile_time_us();
+        uint64_t deadline_us = task_deadline_us(expire);
+        uint32_t drift_us = now_us > deadline_us ? (now_us - deadline_us) : 0;
+
+        tx_drift_stats.tasks++;
+        tx_drift_stats.drift_us += drift_us;
+        tx_drift_stats.drift_max_us = XMAX(tx_drift_stats.drift_max_us, drift_us);
+
+        if (drift_us > TX_DRIFT_LATE_US)
+                tx_drift_stats.late++;
+}
+
+STATIC_FUNC
+void profile_update(void (*func) (void), const char *name, uint8_t type, uint64_t start_us)
+{
+        uint32_t usec = profile_time_us() - start_us;
+        uint32_t bound, i;
+        struct profile_node *pn = avl_find_item(&profile_tree, &func);
+
+        if (!pn) {
+                // strip casts like "(void(*)(void*))func"
+                const char *cast = strrchr(name, ')');
+
+                pn = debugMallocReset(sizeof (struct profile_node), -300579);
+                pn->func = func;
+                pn->type = type;
+                snprintf(pn->name, sizeof (pn->name), "%s", cast ? cast + 1 : name);
+                avl_insert(&profile_tree, pn, -300580);
+        }
+
+        for (i = 0, bound = 10; i < PROFILE_HISTOGRAM_SIZE - 1 && usec >= bound; i++, bound *= 10);
+
+        pn->histogram[i]++;
+        pn->calls++;
+        pn->total_us += usec;
+        pn->max_us = XMAX(pn->max_us, usec);
+}
+
+
+
+STATIC_FUNC
+void fd_event_del(struct fd_event_node *fen)
+{
+        // fails with EBADF or ENOENT if fd has been closed already, which implicitly removes it from the epoll set
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fen->fd, NULL);
+
+        avl_remove(&fd_event_tree, &fen->fd, -300563);
+
+        // keep the node until all events of the current epoll_wait() round have been dispatched:
+        fen->fd_handler = NULL;
+        plist_add_tail(&fd_event_zombie_plist, fen);
+}
+
+STATIC_FUNC
+void fd_event_purge_zombies(void)
+{
+        struct fd_event_node *fen;
+
+        while ((fen = plist_del_head(&fd_event_zombie_plist)))
+                debugFree(fen, -300564);
+}
+
+/*
+ * Must be called before closing a registered fd. close() silently drops the fd from the epoll set, so a
+ * reopened socket which gets the same fd number (and handler and data) would otherwise never be re-added.
+ */
+void fd_event_close(int32_t fd)
+{
+        struct fd_event_node *fen = avl_find_item(&fd_event_tree, &fd);
+
+        if (fen)
+                fd_event_del(fen);
+
+        change_selects();
+}
+
+STATIC_FUNC
+void fd_event_sync(int32_t fd, void (*fd_handler) (int32_t fd, void *data), void *data, const char *name)
+{
+        struct fd_event_node *fen = avl_find_item(&fd_event_tree, &fd);
+
+        if (fen && (fen->fd_handler != fd_handler || fen->data != data)) {
+                fd_event_del(fen);
+                fen = NULL;
+        }
+
+        if (!fen) {
+
+                struct epoll_event ev = {.events = EPOLLIN};
+
+                fen = debugMallocReset(sizeof (struct fd_event_node), -300565);
+                fen->fd = fd;
+                fen->fd_handler = fd_handler;
+                fen->data = data;
+                fen->name = name;
+                ev.data.ptr = fen;
+
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) && (errno != EEXIST || epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev))) {
+                        dbg_sys(DBGT_ERR, "can't register fd=%d: %s", fd, strerror(errno));
+                        debugFree(fen, -300566);
+                        return;
+                }
+
+                avl_insert(&fd_event_tree, fen, -300567);
+        }
+#ifdef EXTREME_PARANOIA
+        else {
+                // an fd closed and reopened without fd_event_close() is no longer in the epoll set:
+                struct epoll_event ev = {.events = EPOLLIN, .data.ptr = fen};
+                assertion_dbg(-501641, (!epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev)),
+                        "fd=%d %s no longer registered: %s", fd, name, strerror(errno));
+        }
+#endif
+
+        fen->generation = fd_event_generation;
+}
+
+
+STATIC_FUNC
+int rx_recvmmsg(int32_t fd, struct mmsghdr *msgs, int32_t vlen)
+{
+        static IDM_T no_recvmmsg = NO;
+        int32_t i;
+
+        if (!no_recvmmsg) {
+
+                int rcvd = recvmmsg(fd, msgs, vlen, MSG_DONTWAIT, NULL);
+
+                if (rcvd >= 0 || errno != ENOSYS)
+                        return rcvd;
+
+                dbgf_sys(DBGT_WARN, "No recvmmsg() support, falling back to recvmsg()");
+                no_recvmmsg = YES;
+        }
+
+        for (i = 0; i < vlen; i++) {
+
+                int rcvd = recvmsg(fd, &msgs[i].msg_hdr, MSG_DONTWAIT);
+
+                if (rcvd < 0)
+                        return i ? i : rcvd;
+
+                msgs[i].msg_len = rcvd;
+        }
+
+        return i;
+}
+
+/*
+ * Takes the kernel receive stamp from the SCM_TIMESTAMPNS (or, on older kernels, SCM_TIMESTAMP) cmsg
+ * enabled by dev_init_sockets(). Without one, the packet gets the wakeup time (bmx_time) of its batch.
+ */
+STATIC_FUNC
+void rx_timestamp(struct msghdr *msghdr, struct packet_buff *pb)
+{
+        struct cmsghdr *cp;
+
+        for (cp = CMSG_FIRSTHDR(msghdr); cp; cp = CMSG_NXTHDR(msghdr, cp)) {
+
+                if (cp->cmsg_level != SOL_SOCKET)
+                        continue;
+#ifdef SO_TIMESTAMPNS
+                if (cp->cmsg_type == SCM_TIMESTAMPNS && cp->cmsg_len >= CMSG_LEN(sizeof (struct timespec))) {
+
+                        memcpy(&(pb->i.tv_stamp), CMSG_DATA(cp), sizeof (struct timespec));
+                        return;
+                }
+#endif
+#ifdef SO_TIMESTAMP
+                if (cp->cmsg_type == SCM_TIMESTAMP && cp->cmsg_len >= CMSG_LEN(sizeof (struct timeval))) {
+
+                        struct timeval tv;
+                        memcpy(&tv, CMSG_DATA(cp), sizeof (struct timeval));
+                        pb->i.tv_stamp.tv_sec = tv.tv_sec;
+                        pb->i.tv_stamp.tv_nsec = tv.tv_usec * 1000;
+                        return;
+                }
+#endif
+        }
+
+        // a zero stamp makes get_rx_time() return bmx_time, the wakeup time shared by the whole batch:
+        memset(&(pb->i.tv_stamp), 0, sizeof (pb->i.tv_stamp));
+}
+
+/*
+ * Drains up to rx_batch_size packets per recvmmsg() call until the socket queue is empty or the rx budget
+ * of this round is exhausted and passes them to rx_packet() in the order they have been received.
+ * Packets left in the socket are picked up by the next (level-triggered) epoll round.
+ */
+STATIC_FUNC
+void rx_batch(int32_t fd, struct dev_node *iif, IDM_T unicast)
+{
+        TRACE_FUNCTION_CALL;
+
+        static struct packet_buff pbs[MAX_RX_BATCH_SIZE];
+        struct mmsghdr msgs[MAX_RX_BATCH_SIZE];
+        struct iovec iovecs[MAX_RX_BATCH_SIZE];
+        union {
+                char buf[CMSG_SPACE(sizeof (struct timespec))];
+                size_t align;
+        } cmsgs[MAX_RX_BATCH_SIZE];
+        int32_t rcvd, i, batch_size = rx_batch_size;
+        uint32_t wakeup_packets = 0;
+        uint16_t selects = changed_readfds;
+        // stays allocated until the end of this epoll round, its fd_handler is reset once the socket is closed:
+        struct fd_event_node *fen = fd_event_dispatched;
+
+        assertion(-501642, (fen && fen->fd == fd && fen->data == iif));
+
+        do {
+                for (i = 0; i < batch_size; i++) {
+                        iovecs[i].iov_base = pbs[i].packet.data;
+                        iovecs[i].iov_len = sizeof (pbs[i].packet.data) - 1;
+                        msgs[i].msg_hdr.msg_name = &pbs[i].i.addr;
+                        msgs[i].msg_hdr.msg_namelen = sizeof (pbs[i].i.addr);
+                        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                        msgs[i].msg_hdr.msg_control = cmsgs[i].buf;
+                        msgs[i].msg_hdr.msg_controllen = sizeof (cmsgs[i].buf);
+                        msgs[i].msg_hdr.msg_flags = 0;
+                        msgs[i].msg_len = 0;
+                }
+
+                errno = 0;
+
+                if ((rcvd = rx_recvmmsg(fd, msgs, batch_size)) < 0) {
+
+                        if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                                dbgf_sys(DBGT_WARN, "sock returned %d errno %d: %s", rcvd, errno, strerror(errno));
+                        }
+
+                        break;
+                }
+
+                for (i = 0; i < rcvd; i++) {
+                        pbs[i].i.iif = iif;
+                        pbs[i].i.unicast = unicast;
+                        pbs[i].i.total_length = msgs[i].msg_len;
+                        rx_timestamp(&msgs[i].msg_hdr, &pbs[i]);
+                }
+
+                // a packet may trigger changes of the registered fds (eg. deactivating iif). The remaining
+                // packets, already taken from the socket, are still processed unless it has been closed:
+                for (i = 0; i < rcvd; i++) {
+
+                        if (!fen->fd_handler) {
+                                rx_batch_stats.drops += rcvd - i;
+                                break;
+                        }
+
+                        rx_packet(&pbs[i]);
+                }
+
+                wakeup_packets += rcvd;
+                rx_round_packets += rcvd;
+
+        } while (rcvd == batch_size && selects == changed_readfds && !(rx_round_yielded = rx_budget_exhausted()));
+
+        rx_batch_stats.wakeups++;
+        rx_batch_stats.packets += wakeup_packets;
+        rx_batch_stats.packets_max = XMAX(rx_batch_stats.packets_max, wakeup_packets);
+}
+
+STATIC_FUNC
+void rx_broadcast_fd_handler(int32_t fd, void *data)
+{
+        rx_batch(fd, (struct dev_node *) data, NO);
+}
+
+STATIC_FUNC
+void rx_unicast_fd_handler(int32_t fd, void *data)
+{
+        rx_batch(fd, (struct dev_node *) data, YES);
+}
+
+STATIC_FUNC
+void plugin_fd_handler(int32_t fd, void *data)
+{
+        (*(((struct cb_fd_node *) data)->cb_fd_handler)) (fd);
+}
+
+STATIC_FUNC
+void timer_fd_handler(int32_t fd, void *data)
+{
+        uint64_t expirations;
+
+        // just drain it, expired tasks are executed by task_next()
+        if (read(fd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN) {
+                dbgf_sys(DBGT_ERR, "can't read timerfd: %s", strerror(errno));
+        }
+}
+
+STATIC_FUNC
+void unix_sock_fd_handler(int32_t fd, void *data)
+{
+        accept_ctrl_node();
+}
+
+STATIC_FUNC
+void ctrl_node_fd_handler(int32_t fd, void *data)
+{
+        //omit debugging here since event could be a closed -d4 ctrl socket
+        //which should be removed before debugging
+        handle_ctrl_node((struct ctrl_node *) data);
+}
+
+
+STATIC_FUNC
+void profile_fd_handler(struct fd_event_node *fen)
+{
+        // account plugin fds by their own handler to tell them apart:
+        void (*func) (void) = (fen->fd_handler == plugin_fd_handler) ?
+                (void (*) (void)) ((struct cb_fd_node *) fen->data)->cb_fd_handler : (void (*) (void)) fen->fd_handler;
+        uint64_t start_us = profile_time_us();
+
+        (*(fen->fd_handler)) (fen->fd, fen->data);
+
+        profile_update(func, fen->name, PROFILE_FD, start_us);
+}
+
 static void check_selects(void)
 {
         TRACE_FUNCTION_CALL;
 
         if (changed_readfds) {
 
-                FD_ZERO(&receive_wait_set);
-                receive_max_sock = 0;
+                struct avl_node *it;
+                struct fd_event_node *fen;
+                int32_t fd;
 
-                //	receive_max_sock = ifevent_sk;
-                //	FD_SET(ifevent_sk, &receive_wait_set);
-                //	if ( receive_max_sock < unix_sock )
-                //		receive_max_sock = unix_sock;
+                if (!epoll_fd) {
+                        if ((epoll_fd = epoll_create(MAX_EPOLL_EVENTS)) < 0) {
+                                dbg_sys(DBGT_ERR, "can't create epoll fd: %s", strerror(errno));
+                                cleanup_all(-501579);
+                        }
+                        fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+
+                        if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+                                dbg_sys(DBGT_WARN, "can't create timerfd: %s, using epoll_wait() timeouts", strerror(errno));
+                                timer_fd = 0;
+                        }
+                }
+
+                fd_event_generation++;
+
+                if (timer_fd > 0)
+                        fd_event_sync(timer_fd, timer_fd_handler, NULL, "timer_fd");
 
                 assertion(-501099, (unix_sock > 0));
 
-                receive_max_sock = XMAX(receive_max_sock, unix_sock);
-                FD_SET(unix_sock, &receive_wait_set);
+                fd_event_sync(unix_sock, unix_sock_fd_handler, NULL, "unix_sock");
 
                 struct ctrl_node *cn = NULL;
                 while ((cn = list_iterate(&ctrl_list, cn))) {
 
-                        if (cn->fd > 0 && cn->fd != STDOUT_FILENO) {
-
-                                receive_max_sock = XMAX(receive_max_sock, cn->fd);
-                                FD_SET(cn->fd, &receive_wait_set);
-                        }
+                        if (cn->fd > 0 && cn->fd != STDOUT_FILENO)
+                                fd_event_sync(cn->fd, ctrl_node_fd_handler, cn, "ctrl_node");
                 }
 
-                struct avl_node *it = NULL;
                 struct dev_node *dev;
-                while ((dev = avl_iterate_item(&dev_ip_tree, &it))) {
+                for (it = NULL; (dev = avl_iterate_item(&dev_ip_tree, &it));) {
 
                         if (dev->active && dev->linklayer != TYP_DEV_LL_LO) {
 
-                                receive_max_sock = XMAX(receive_max_sock, dev->unicast_sock);
-                                FD_SET(dev->unicast_sock, &receive_wait_set);
-
-                                receive_max_sock = XMAX(receive_max_sock, dev->rx_mcast_sock);
-                                FD_SET(dev->rx_mcast_sock, &receive_wait_set);
+                                fd_event_sync(dev->unicast_sock, rx_unicast_fd_handler, dev, "rx_unicast");
 
-                                if (dev->rx_fullbrc_sock > 0) {
+                                fd_event_sync(dev->rx_mcast_sock, rx_broadcast_fd_handler, dev, "rx_broadcast");
 
-                                        receive_max_sock = XMAX(receive_max_sock, dev->rx_fullbrc_sock);
-                                        FD_SET(dev->rx_fullbrc_sock, &receive_wait_set);
-                                }
+                                if (dev->rx_fullbrc_sock > 0)
+                                        fd_event_sync(dev->rx_fullbrc_sock, rx_broadcast_fd_handler, dev, "rx_broadcast");
                         }
                 }
 
                 struct cb_fd_node *cdn = NULL;
-                while ((cdn = list_iterate(&cb_fd_list, cdn))) {
+                while ((cdn = list_iterate(&cb_fd_list, cdn)))
+                        fd_event_sync(cdn->fd, plugin_fd_handler, cdn, "plugin_fd");
+
+                // remove all fds which have not been refreshed above:
+                for (fen = avl_first_item(&fd_event_tree); fen; fen = avl_next_item(&fd_event_tree, &fd)) {
+
+                        fd = fen->fd;
 
-                        receive_max_sock = XMAX(receive_max_sock, cdn->fd);
-                        FD_SET(cdn->fd, &receive_wait_set);
+                        if (fen->generation != fd_event_generation)
+                                fd_event_del(fen);
                 }
 
-                dbgf_all(DBGT_INFO, "updated changed=%d", changed_readfds);
+                dbgf_all(DBGT_INFO, "updated changed=%d registered=%d", changed_readfds, fd_event_tree.items);
                 changed_readfds = 0;
         }
 }
 
 
 
+/*
+ * Pending tasks are kept in a binary min-heap ordered by (expire, sqn) so that the next due task is found in O(1)
+ * and (re)scheduled in O(log n). task_tree indexes the same nodes by (task, data) so task_remove() does not scan.
+ * The sqn tie-breaker preserves the FIFO order of tasks registered for the same expiry time.
+ */
 
+STATIC_INLINE_FUNC
+IDM_T task_heap_less(struct task_node *a, struct task_node *b)
+{
+        return a->expire == b->expire ? U32_LT(a->sqn, b->sqn) : U32_LT(a->expire, b->expire);
+}
 
-void task_register(TIME_T timeout, void (* task) (void *), void *data, int32_t tag)
+STATIC_INLINE_FUNC
+void task_heap_set(uint32_t pos, struct task_node *tn)
 {
+        task_heap[pos] = tn;
+        tn->heap_pos = pos;
+}
 
-        TRACE_FUNCTION_CALL;
+STATIC_FUNC
+void task_heap_up(uint32_t pos)
+{
+        struct task_node *tn = task_heap[pos];
 
-        assertion(-500475, (task_remove(task, data) == FAILURE));
-        assertion(-500989, (timeout <= REGISTER_TASK_TIMEOUT_MAX ));
+        while (pos > 0 && task_heap_less(tn, task_heap[(pos - 1) / 2])) {
+                task_heap_set(pos, task_heap[(pos - 1) / 2]);
+                pos = (pos - 1) / 2;
+        }
 
-	struct list_node *list_pos, *prev_pos = (struct list_node *)&task_list;
-	struct task_node *tmp_tn = NULL;
+        task_heap_set(pos, tn);
+}
 
-	
-	//TODO: allocating and freeing tn and tn->data may be much faster when done by registerig function.. 
-	struct task_node *tn = debugMallocReset( sizeof( struct task_node ), tag );
-	
-	tn->expire = bmx_time + timeout;
-	tn->task = task;
-	tn->data = data;
-	
-	
-	list_for_each( list_pos, &task_list ) {
+STATIC_FUNC
+void task_heap_down(uint32_t pos)
+{
+        struct task_node *tn = task_heap[pos];
+        uint32_t child;
 
-		tmp_tn = list_entry( list_pos, struct task_node, list );
+        while ((child = (2 * pos) + 1) < task_heap_items) {
 
-		if ( U32_GT(tmp_tn->expire, tn->expire) ) {
+                if (child + 1 < task_heap_items && task_heap_less(task_heap[child + 1], task_heap[child]))
+                        child++;
 
-                        list_add_after(&task_list, prev_pos, &tn->list);
-			break;
+                if (!task_heap_less(task_heap[child], tn))
+                        break;
 
-		}
+                task_heap_set(pos, task_heap[child]);
+                pos = child;
+        }
 
-		prev_pos = &tmp_tn->list;
+        task_heap_set(pos, tn);
+}
 
-	}
+STATIC_FUNC
+void task_heap_remove(uint32_t pos)
+{
+        if (pos != --task_heap_items) {
+
+                task_heap_set(pos, task_heap[task_heap_items]);
+
+                if (pos > 0 && task_heap_less(task_heap[pos], task_heap[(pos - 1) / 2]))
+                        task_heap_up(pos);
+                else
+                        task_heap_down(pos);
+        }
+
+        task_heap[task_heap_items] = NULL;
+}
+
+STATIC_FUNC
+void task_unlink(struct task_node *tn)
+{
+        uint32_t pos = tn->heap_pos;
+
+        avl_remove(&task_tree, &tn->key, -300568);
 
-	if ( ( tmp_tn == NULL ) || ( U32_LE(tmp_tn->expire, tn->expire) ))
-                list_add_tail(&task_list, &tn->list);
+        if (pos & TASK_EXPIRED) {
+                // detached by the current expiry pass of task_next(), just don't execute it:
+                assertion(-501582, ((pos & ~TASK_EXPIRED) < task_expired_items && task_expired[pos & ~TASK_EXPIRED] == tn));
+                task_expired[pos & ~TASK_EXPIRED] = NULL;
+        } else {
+                assertion(-501580, (pos < task_heap_items && task_heap[pos] == tn));
+                task_heap_remove(pos);
+        }
+}
+
+
+void _task_register(TIME_T timeout, void (* task) (void *), const char *name, void *data, int32_t tag)
+{
+
+        TRACE_FUNCTION_CALL;
+
+        struct task_key key = {.task = task, .data = data};
+
+        assertion(-500475, (!avl_find(&task_tree, &key)));
+        assertion(-500989, (timeout <= REGISTER_TASK_TIMEOUT_MAX ));
+
+	//TODO: allocating and freeing tn and tn->data may be much faster when done by registerig function.. 
+	struct task_node *tn = debugMallocReset( sizeof( struct task_node ), tag );
 	
+	tn->key = key;
+	tn->name = name;
+	tn->expire = bmx_time + timeout;
+	tn->sqn = task_sqn++;
+
+        if (task_heap_items >= task_heap_size) {
+                task_heap_size = task_heap_size ? (2 * task_heap_size) : TASK_HEAP_SIZE_MIN;
+                task_heap = debugRealloc(task_heap, task_heap_size * sizeof (struct task_node *), -300569);
+        }
+
+        avl_insert(&task_tree, tn, -300570);
+
+        task_heap_set(task_heap_items++, tn);
+        task_heap_up(tn->heap_pos);
 }
 
 
@@ -159,72 +637,88 @@ IDM_T task_remove(void (* task) (void *), void *data)
 {
         TRACE_FUNCTION_CALL;
 
-	struct list_node *list_pos, *tmp_pos, *prev_pos = (struct list_node*)&task_list;
-        IDM_T ret = FAILURE;
-		
-	list_for_each_safe( list_pos, tmp_pos, &task_list ) {
-			
-		struct task_node *tn = list_entry( list_pos, struct task_node, list );
-			
-		if ( tn->task == task && tn->data == data  ) {
-
-                        list_del_next(&task_list, prev_pos);
-			
-			debugFree( tn, -300080 );
-#ifndef EXTREME_PARANOIA
-                        return SUCCESS;
-#else
-                        ASSERTION(-500474, (ret == FAILURE));
-                        ret = SUCCESS;
-#endif
-			
-		} else {
-			
-			prev_pos = list_pos;
-		}
-	}
+        struct task_key key = {.task = task, .data = data};
+        struct task_node *tn = avl_find_item(&task_tree, &key);
+
+        if (!tn)
+                return FAILURE;
+
+        task_unlink(tn);
 
-        return ret;
+        debugFree(tn, -300080);
+
+        return SUCCESS;
 }
 
+IDM_T task_registered(void (* task) (void *), void *data)
+{
+        struct task_key key = {.task = task, .data = data};
 
+        return avl_find(&task_tree, &key) ? YES : NO;
+}
+
+
+/*
+ * Detaches all tasks expired by now from the heap at once and executes them in deadline order.
+ * Tasks removed meanwhile (by previously executed ones) are skipped.
+ * Tasks (re-)registered during the pass go into the heap and are considered by the next call,
+ * returning 0 if they are already due.
+ */
 TIME_T task_next( void )
 {
         TRACE_FUNCTION_CALL;
 
-        struct list_node *list_pos, *tmp_pos, *prev_pos;
+        struct task_node *tn;
+        uint32_t i;
+
+        assertion(-501583, (!task_expired_items));
 
-task_next_again:
-        prev_pos = (struct list_node*) &task_list;
+        while (task_heap_items && U32_LE(task_heap[0]->expire, bmx_time)) {
 
-	list_for_each_safe( list_pos, tmp_pos, &task_list ) {
-			
-		struct task_node *tn = list_entry( list_pos, struct task_node, list );
-			
-		if ( U32_LE( tn->expire, bmx_time )  ) {
+                tn = task_heap[0];
+                task_heap_remove(0);
 
-                        void (* task) (void *fpara) = tn->task;
-                        void *data = tn->data;
+                if (task_expired_items >= task_expired_size) {
+                        task_expired_size = task_expired_size ? (2 * task_expired_size) : TASK_HEAP_SIZE_MIN;
+                        task_expired = debugRealloc(task_expired, task_expired_size * sizeof (struct task_node *), -300584);
+                }
 
-			list_del_next( &task_list, prev_pos );
-			debugFree( tn, -300081 ); // remove before executing because otherwise we get memory leak if taks causes an assertion
-			
-			(*(task)) (data);
+                task_expired[task_expired_items] = tn;
+                tn->heap_pos = (task_expired_items++) | TASK_EXPIRED;
+        }
 
-                        CHECK_INTEGRITY();
+        for (i = 0; i < task_expired_items; i++) {
 
-                        //dbgf_track(DBGT_INFO, "executed %p", task );
+                if (!(tn = task_expired[i]))
+                        continue;
 
-                        goto task_next_again;
-                        return 0;
-			
-		} else {
-			
-			return tn->expire - bmx_time;
-		}
-	}
-	
-	return MAX_SELECT_TIMEOUT_MS;
+                void (* task) (void *fpara) = tn->key.task;
+                void *data = tn->key.data;
+                const char *name = tn->name;
+
+                if (task == tx_packets || task == tx_packet)
+                        tx_drift_update(tn->expire);
+
+                task_unlink(tn);
+                debugFree(tn, -300081); // remove before executing because otherwise we get memory leak if taks causes an assertion
+
+                if (profiling) {
+                        uint64_t start_us = profile_time_us();
+                        (*(task)) (data);
+                        profile_update((void (*) (void)) task, name, PROFILE_TASK, start_us);
+                } else {
+                        (*(task)) (data);
+                }
+
+                CHECK_INTEGRITY();
+        }
+
+        task_expired_items = 0;
+
+        if (!task_heap_items)
+                return MAX_SELECT_TIMEOUT_MS;
+
+        return U32_LE(task_heap[0]->expire, bmx_time) ? 0 : (task_heap[0]->expire - bmx_time);
 }
 
 
@@ -232,51 +726,44 @@ task_next_again:
 void wait4Event(TIME_T timeout)
 {
         TRACE_FUNCTION_CALL;
-	static struct packet_buff pb;
-	
-	TIME_T last_get_time_result = 0;
-
-        static uint32_t addr_len = sizeof (pb.i.addr);
 
 	TIME_T return_time = bmx_time + timeout;
-	struct timeval tv;
-	struct list_node *list_pos;
-	int selected;
-	fd_set tmp_wait_set;
-		
-	
-loop4Event:
-	
-	while ( U32_GT(return_time, bmx_time) ) {
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	int selected, first, j;
+
+	check_selects();
+
+	if (timer_fd > 0) {
 
+		struct itimerspec its = {.it_interval = {0, 0}};
+
+		// absolute CLOCK_MONOTONIC expiry, so we wake up exactly when the next task is due:
+		get_monotonic_time(return_time, &its.it_value);
+
+		if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+			dbg_sys(DBGT_ERR, "can't arm timerfd: %s", strerror(errno));
+		}
+	}
+
+	while ( U32_GT(return_time, bmx_time) ) {
 
 		check_selects();
-		
-		memcpy( &tmp_wait_set, &receive_wait_set, sizeof(fd_set) );
-			
-		tv.tv_sec  =   (return_time - bmx_time) / 1000;
-		tv.tv_usec = ( (return_time - bmx_time) % 1000 ) * 1000;
-			
-		selected = select( receive_max_sock + 1, &tmp_wait_set, NULL, NULL, &tv );
-
-		upd_time( &(pb.i.tv_stamp) );
-
-                //dbgf_track(DBGT_INFO, "select=%d", selected);
-		
-		//omit debugging here since event could be a closed -d4 ctrl socket 
+
+		// with a timerfd the epoll_wait() timeout is only a safety net
+		selected = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS,
+			(return_time - bmx_time) + (timer_fd > 0 ? MAX_SELECT_SAFETY_MS : 1));
+
+		upd_time( NULL );
+
+		// fd handlers must yield to the timers once the next task is due or their budget is used up:
+		rx_round_packets = 0;
+		rx_round_yielded = NO;
+		rx_round_deadline_us = XMIN(profile_time_us() + rx_budget_time, task_deadline_us(return_time));
+
+		//omit debugging here since event could be a closed -d4 ctrl socket
 		//which should be removed before debugging
 		//dbgf_all( DBGT_INFO, "timeout %d", timeout );
-		
-		if ( bmx_time < last_get_time_result ) {
-				
-			last_get_time_result = bmx_time;
-			dbg_sys(DBGT_WARN, "detected Timeoverlap..." );
-			
-			goto wait4Event_end;
-		}
-	
-		last_get_time_result = bmx_time;
-					
+
 		if ( selected < 0 ) {
                         static TIME_T last_interrupted_syscall = 0;
 
@@ -289,238 +776,534 @@ loop4Event:
 
 			wait_sec_usec( 0, 1000 );
 			upd_time( NULL );
-			
-			goto wait4Event_end;
+
+			break;
 		}
-	
-		if ( selected == 0 ) {
-	
-			//Often select returns just a few milliseconds before being scheduled
-			if ( U32_LT( return_time, (bmx_time + 10) ) ) {
-					
-				//cheating time :-)
-				bmx_time = return_time;
-				
-				goto wait4Event_end;
-			}
-					
-			//if ( LESS_U32( return_time, bmx_time ) )
-                        dbgf_track(DBGT_WARN, "select() returned %d without reason!! return_time %d, curr_time %d",
-			     selected, return_time, bmx_time );
-				
-			goto loop4Event;
+
+		// epoll_wait() keeps reporting ready fds in the same order. So a round continues (round-robin)
+		// with the fd skipped by the previous one, otherwise a flooded first fd would starve all others:
+		for (first = 0; first < selected && rx_round_resume_fd >= 0; first++) {
+			if (((struct fd_event_node *) events[first].data.ptr)->fd == rx_round_resume_fd)
+				break;
 		}
-		
-/*
-		// check for changed interface status...
-		if ( FD_ISSET( ifevent_sk, &tmp_wait_set ) ) {
 
-                        dbgf_track(DBGT_INFO, "detected changed interface status! Going to check interfaces!");
-			
-			recv_ifevent_netlink_sk( );
+		first = (first < selected) ? first : 0;
+		rx_round_resume_fd = -1;
 
-                        dev_check2();
-			
+		// only ready fds are visited, each one carries its own handler and data:
+		for (j = 0; j < selected; j++) {
 
-			//do NOT delay checking of interfaces to not miss ifdown/up of interfaces !!
-                        if (kernel_if_config() ) //just call if changed!
-                                dev_check(YES);
+			struct fd_event_node *fen = events[(first + j) % selected].data.ptr;
 
-			
-			goto wait4Event_end;
-		}
-		
-*/
-		
-		// check for received packets...
-                struct avl_node *it = NULL;
-                while ((pb.i.iif = avl_iterate_item(&dev_ip_tree, &it))) {
-
-			if ( pb.i.iif->linklayer == TYP_DEV_LL_LO )
-				continue;
-				
-			if ( FD_ISSET( pb.i.iif->rx_mcast_sock, &tmp_wait_set ) ) {
-	
-				pb.i.unicast = NO;
-				
-				errno=0;
-				pb.i.total_length = recvfrom( pb.i.iif->rx_mcast_sock, pb.packet.data,
-				                             sizeof(pb.packet.data) - 1, 0,
-				                             (struct sockaddr *)&pb.i.addr, (socklen_t*)&addr_len );
-				
-				if ( pb.i.total_length < 0  &&  ( errno == EWOULDBLOCK || errno == EAGAIN ) ) {
-
-                                        dbgf_sys(DBGT_WARN, "sock returned %d errno %d: %s",
-					    pb.i.total_length, errno, strerror(errno) );
-					
-					continue;
-				}
+			// remaining ready fds are reported again by the next epoll_wait():
+			if (rx_budget_exhausted()) {
 
-				ioctl(pb.i.iif->rx_mcast_sock, SIOCGSTAMP, &(pb.i.tv_stamp)) ;
-				
-				rx_packet( &pb );
-				
-				if ( --selected == 0 )
-					goto loop4Event;
+				for (; j < selected && rx_round_resume_fd < 0; j++) {
 
-			}
-			
-			if ( FD_ISSET( pb.i.iif->rx_fullbrc_sock, &tmp_wait_set ) ) {
-				
-				pb.i.unicast = NO;
-				
-				errno=0;
-				pb.i.total_length = recvfrom( pb.i.iif->rx_fullbrc_sock, pb.packet.data,
-				                             sizeof(pb.packet.data) - 1, 0,
-				                             (struct sockaddr *)&pb.i.addr, (socklen_t*)&addr_len );
-				
-				if ( pb.i.total_length < 0  &&  ( errno == EWOULDBLOCK || errno == EAGAIN ) ) {
-
-                                        dbgf_sys(DBGT_WARN, "sock returned %d errno %d: %s",
-					     pb.i.total_length, errno, strerror(errno) );
-					
-					continue;
-				}
-				
-				ioctl(pb.i.iif->rx_fullbrc_sock, SIOCGSTAMP, &(pb.i.tv_stamp)) ;
-				
-				rx_packet( &pb );
-				
-				if ( --selected == 0 )
-					goto loop4Event;
-				
-			}
-			
-			
-			if ( FD_ISSET( pb.i.iif->unicast_sock, &tmp_wait_set ) ) {
-				
-				pb.i.unicast = YES;
-					
-				struct msghdr msghdr;
-				struct iovec iovec = {.iov_base = pb.packet.data, .iov_len = sizeof(pb.packet.data) - 1};
-				char buf[4096];
-				struct cmsghdr *cp;
-				struct timeval *tv_stamp = NULL;
-	
-				msghdr.msg_name = (struct sockaddr *)&pb.i.addr;
-				msghdr.msg_namelen = addr_len;
-				msghdr.msg_iov = &iovec;
-				msghdr.msg_iovlen = 1;
-				msghdr.msg_control = buf;
-				msghdr.msg_controllen = sizeof( buf );
-				msghdr.msg_flags = 0;
-				
-				errno=0;
-				
-				pb.i.total_length = recvmsg( pb.i.iif->unicast_sock, &msghdr, MSG_DONTWAIT  );
-				
-				if ( pb.i.total_length < 0  &&  ( errno == EWOULDBLOCK || errno == EAGAIN ) ) {
-                                        dbgf_sys(DBGT_WARN, "sock returned %d errno %d: %s",
-					    pb.i.total_length, errno, strerror(errno) );
-					continue;
-				}
-						
-#ifdef SO_TIMESTAMP
-				for (cp = CMSG_FIRSTHDR(&msghdr); cp; cp = CMSG_NXTHDR(&msghdr, cp)) {
-						
-					if ( 	cp->cmsg_type == SO_TIMESTAMP && 
-						cp->cmsg_level == SOL_SOCKET && 
-						cp->cmsg_len >= CMSG_LEN(sizeof(struct timeval)) )  {
-	
-						tv_stamp = (struct timeval*)CMSG_DATA(cp);
-						break;
-					}
+					fen = events[(first + j) % selected].data.ptr;
+
+					if (fen->fd != timer_fd)
+						rx_round_resume_fd = fen->fd;
 				}
-#endif
-				if ( tv_stamp == NULL )
-					ioctl( pb.i.iif->unicast_sock, SIOCGSTAMP, &(pb.i.tv_stamp) );
-				else
-					timercpy( tv_stamp, &(pb.i.tv_stamp) );
-				
-				rx_packet( &pb );
-				
-				if ( --selected == 0)
-					goto loop4Event;
-					//goto wait4Event_end;
 
+				rx_round_yielded |= (rx_round_resume_fd >= 0);
+				break;
 			}
-		
+
+			// handlers may (un)register fds, devices, plugins, or control clients.
+			// Resyncing invalidates events whose fd or data has been removed meanwhile.
+			check_selects();
+
+			fd_event_dispatched = fen;
+
+			if (fen->fd_handler && profiling)
+				profile_fd_handler(fen);
+			else if (fen->fd_handler)
+				(*(fen->fd_handler)) (fen->fd, fen->data);
+
+			fd_event_dispatched = NULL;
 		}
-		
-loop4ActivePlugins:
 
-		// check active plugins...
-		list_for_each( list_pos, &cb_fd_list ) {
-	
-			struct cb_fd_node *cdn = list_entry( list_pos, struct cb_fd_node, list );
-	
-			if ( FD_ISSET( cdn->fd, &tmp_wait_set ) ) {
-				
-				FD_CLR( cdn->fd, &tmp_wait_set );
-				
-				(*(cdn->cb_fd_handler)) (cdn->fd); 
-				
-				// list might have changed, due to unregistered handlers, reiterate NOW
-				//TODO: check if fd was really consumed !
-				if ( --selected == 0 )
-					goto loop4Event;
-				
-				goto loop4ActivePlugins;
-			}
+		fd_event_purge_zombies();
+
+		if (rx_round_yielded)
+			rx_batch_stats.yields++;
+
+		if (rx_round_yielded || rx_budget_exhausted())
+			break;
+	}
+
+	dbgf_all( DBGT_INFO, "end of function");
+}
+
+
+
 
+#ifdef SCHEDULE_TEST
+
+/*
+ * Compares the task heap against the former sorted task_list using n timers with random timeouts:
+ * Each timer gets registered, rescheduled once (task_remove() + task_register()), and finally removed.
+ * The list variant replicates the former task_register() and task_remove(), including their allocations.
+ */
+
+struct task_bench_list_node {
+	struct list_node list;
+	TIME_T expire;
+	void *data;
+};
+
+STATIC_FUNC
+void task_bench_dummy(void *data)
+{
+}
+
+STATIC_FUNC
+void task_bench_list_register(struct list_head *lh, struct task_bench_list_node *tn)
+{
+	struct list_node *list_pos, *prev_pos = (struct list_node *) lh;
+	struct task_bench_list_node *tmp_tn = NULL;
+
+	list_for_each(list_pos, lh) {
+
+		tmp_tn = list_entry(list_pos, struct task_bench_list_node, list);
+
+		if (U32_GT(tmp_tn->expire, tn->expire)) {
+			list_add_after(lh, prev_pos, &tn->list);
+			return;
 		}
-		
-
-		// check for new control clients...
-		if ( FD_ISSET( unix_sock, &tmp_wait_set ) ) {
-				
-			accept_ctrl_node();
-			
-			if ( --selected == 0 )
-				goto loop4Event;
-			
+
+		prev_pos = &tmp_tn->list;
+	}
+
+	list_add_tail(lh, &tn->list);
+}
+
+STATIC_FUNC
+struct task_bench_list_node *task_bench_list_remove(struct list_head *lh, void *data)
+{
+	struct list_node *list_pos, *prev_pos = (struct list_node *) lh;
+
+	list_for_each(list_pos, lh) {
+
+		struct task_bench_list_node *tn = list_entry(list_pos, struct task_bench_list_node, list);
+
+		if (tn->data == data) {
+			list_del_next(lh, prev_pos);
+			return tn;
 		}
-			
-	
-loop4ActiveClients:
-		// check for all connected control clients...
-		list_for_each( list_pos, &ctrl_list ) {
-			
-			struct ctrl_node *client = list_entry( list_pos, struct ctrl_node, list );
-				
-			if ( FD_ISSET( client->fd, &tmp_wait_set ) ) {
-					
-				FD_CLR( client->fd, &tmp_wait_set );
-				
-				//omit debugging here since event could be a closed -d4 ctrl socket 
-				//which should be removed before debugging
-				//dbgf_all( DBGT_INFO, "got msg from control client");
-					
-				handle_ctrl_node( client );
-				
-				--selected;
-				
-				// return straight because client might be removed and list might have changed.
-				goto loop4ActiveClients;
-			} 
-		
+
+		prev_pos = list_pos;
+	}
+
+	return NULL;
+}
+
+STATIC_FUNC
+uint32_t task_bench_usec(struct timeval *start)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &diff);
+	gettimeofday(start, NULL);
+
+	return (diff.tv_sec * 1000000) + diff.tv_usec;
+}
+
+STATIC_FUNC
+void task_bench(int32_t n)
+{
+	LIST_SIMPEL(bench_list, struct task_bench_list_node, list, list);
+	TIME_T *timeouts = debugMalloc(2 * n * sizeof (TIME_T), -300572);
+	uint8_t *data_ptrs = debugMallocReset(n, -300573); // just distinct data pointers
+	uint32_t heap_reg, heap_resched, heap_rem, list_reg, list_resched, list_rem;
+	struct timeval start;
+	int32_t i;
+
+	for (i = 0; i < 2 * n; i++)
+		timeouts[i] = rand_num(REGISTER_TASK_TIMEOUT_MAX);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < n; i++)
+		task_register(timeouts[i], task_bench_dummy, &data_ptrs[i], -300574);
+
+	heap_reg = task_bench_usec(&start);
+
+	for (i = 0; i < n; i++) {
+		task_remove(task_bench_dummy, &data_ptrs[i]);
+		task_register(timeouts[n + i], task_bench_dummy, &data_ptrs[i], -300574);
+	}
+
+	heap_resched = task_bench_usec(&start);
+
+	for (i = 0; i < n; i++)
+		task_remove(task_bench_dummy, &data_ptrs[i]);
+
+	heap_rem = task_bench_usec(&start);
+
+	for (i = 0; i < n; i++) {
+		struct task_bench_list_node *tn = debugMallocReset(sizeof (struct task_bench_list_node), -300577);
+		tn->data = &data_ptrs[i];
+		tn->expire = bmx_time + timeouts[i];
+		task_bench_list_register(&bench_list, tn);
+	}
+
+	list_reg = task_bench_usec(&start);
+
+	for (i = 0; i < n; i++) {
+		struct task_bench_list_node *tn = debugMallocReset(sizeof (struct task_bench_list_node), -300577);
+		debugFree(task_bench_list_remove(&bench_list, &data_ptrs[i]), -300578);
+		tn->data = &data_ptrs[i];
+		tn->expire = bmx_time + timeouts[n + i];
+		task_bench_list_register(&bench_list, tn);
+	}
+
+	list_resched = task_bench_usec(&start);
+
+	for (i = 0; i < n; i++)
+		debugFree(task_bench_list_remove(&bench_list, &data_ptrs[i]), -300578);
+
+	list_rem = task_bench_usec(&start);
+
+	printf("timers=%d             register   reschedule       remove (usec)\n", n);
+	printf("task heap:        %10u   %10u   %10u\n", heap_reg, heap_resched, heap_rem);
+	printf("sorted task_list: %10u   %10u   %10u\n", list_reg, list_resched, list_rem);
+	printf("speedup:          %10.1f   %10.1f   %10.1f\n",
+		(double) list_reg / XMAX(heap_reg, 1), (double) list_resched / XMAX(heap_resched, 1), (double) list_rem / XMAX(heap_rem, 1));
+
+	debugFree(data_ptrs, -300575);
+	debugFree(timeouts, -300576);
+
+	cleanup_all(CLEANUP_SUCCESS);
+}
+
+static int32_t task_bench_timers = 10000;
+
+STATIC_FUNC
+int32_t opt_task_bench(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
+{
+
+	if ( cmd == OPT_APPLY )
+		task_bench(task_bench_timers);
+
+	return SUCCESS;
+}
+
+
+/*
+ * Regression test for expiry passes of task_next(): tasks removing other expired or pending tasks,
+ * and tasks registering new ones while the pass is running. Each test task appends its id to task_test_log.
+ */
+static char task_test_ids[] = "ABCDEFGH";
+static char task_test_log[32];
+
+STATIC_FUNC
+void task_test_task(void *data)
+{
+	char id = *((char *) data);
+
+	task_test_log[strlen(task_test_log)] = id;
+
+	if (id == 'A') // remove B, expired in the same pass
+		task_remove(task_test_task, &task_test_ids[1]);
+	else if (id == 'C') // remove E, still pending
+		task_remove(task_test_task, &task_test_ids[4]);
+	else if (id == 'D') // register F, already due, but not within the running pass
+		task_register(0, task_test_task, &task_test_ids[5], -300586);
+	else if (id == 'F') { // register and remove G, and remove A, which has been executed already
+		task_register(0, task_test_task, &task_test_ids[6], -300586);
+		task_remove(task_test_task, &task_test_ids[6]);
+		task_remove(task_test_task, &task_test_ids[0]);
+	}
+}
+
+STATIC_FUNC
+int32_t opt_task_test(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
+{
+	if ( cmd == OPT_APPLY ) {
+
+		struct task_node *tn;
+		char pass1[sizeof (task_test_log)];
+		uint32_t pending = task_tree.items;
+		TIME_T first, second;
+
+		memset(task_test_log, 0, sizeof (task_test_log));
+
+		task_register(5, task_test_task, &task_test_ids[7], -300586); // H: due after A-D
+		task_register(0, task_test_task, &task_test_ids[0], -300586);
+		task_register(0, task_test_task, &task_test_ids[1], -300586);
+		task_register(0, task_test_task, &task_test_ids[2], -300586);
+		task_register(0, task_test_task, &task_test_ids[3], -300586);
+		task_register(100, task_test_task, &task_test_ids[4], -300586);
+
+		bmx_time += 10; // let all but E expire
+		first = task_next();
+		strcpy(pass1, task_test_log);
+		memset(task_test_log, 0, sizeof (task_test_log));
+		second = task_next();
+		upd_time(NULL);
+
+		for (tn = avl_first_item(&task_tree); tn; tn = avl_next_item(&task_tree, &tn->key)) {
+			if (tn->key.task == task_test_task)
+				break;
 		}
 
-		
+		printf("timerTest: pass1=%s (expected ACDH) pass2=%s (expected F) first=%d second=%d tasks=%d (expected %d) leftover=%s\n",
+			pass1, task_test_log, first, second, task_tree.items, pending, tn ? "YES" : "NO");
 
-                if (selected) {
-                        dbg_track(DBGT_WARN, "select() returned %d unhandled event(s)!! return_time %d, curr_time %d",
-                                selected, return_time, bmx_time);
-                }
-		
-		break;
+		if (strcmp(pass1, "ACDH") || strcmp(task_test_log, "F") || first != 0 || tn || task_tree.items != pending) {
+			printf("timerTest: FAILED\n");
+			cleanup_all(-501584);
+		}
+
+		printf("timerTest: passed\n");
+		cleanup_all(CLEANUP_SUCCESS);
 	}
-	
-wait4Event_end:
-	
-	dbgf_all( DBGT_INFO, "end of function");
-	
-	return;
+
+	return SUCCESS;
+}
+
+
+/*
+ * Regression test for the fairness of fd dispatching: One socket is flooded endlessly (each packet read is
+ * sent again) and accounted against the rx budget like rx_batch(). Another socket and a control client,
+ * both ready after the flooded one, must still be served within a second.
+ */
+static int32_t rx_test_fds[4]; // flooded socket pair, served socket pair
+static int32_t rx_test_ctrl_fd = 0;
+static uint32_t rx_test_flooded = 0;
+static uint32_t rx_test_served = 0;
+
+STATIC_FUNC
+void rx_test_flood_hook(int32_t fd)
+{
+	char buff[32];
+	int32_t len;
+
+	do {
+		if ((len = read(fd, buff, sizeof (buff))) <= 0 || write(rx_test_fds[1], buff, len) != len)
+			break;
+
+		rx_test_flooded++;
+		rx_round_packets++;
+
+	} while (!(rx_round_yielded = rx_budget_exhausted()));
+}
+
+STATIC_FUNC
+void rx_test_served_hook(int32_t fd)
+{
+	char buff[32];
+
+	if (read(fd, buff, sizeof (buff)) > 0)
+		rx_test_served++;
+}
+
+STATIC_FUNC
+void rx_test_check(void *unused)
+{
+	char buff[MAX_UNIX_MSG_SIZE];
+	int32_t replied = read(rx_test_ctrl_fd, buff, sizeof (buff));
+
+	printf("rxFairnessTest: flooded=%u served=%u (expected >0) ctrl_reply=%d (expected >0) yields=%u\n",
+		rx_test_flooded, rx_test_served, replied, rx_batch_stats.yields);
+
+	set_fd_hook(rx_test_fds[0], rx_test_flood_hook, DEL);
+	set_fd_hook(rx_test_fds[2], rx_test_served_hook, DEL);
+
+	close(rx_test_fds[0]);
+	close(rx_test_fds[1]);
+	close(rx_test_fds[2]);
+	close(rx_test_fds[3]);
+	close(rx_test_ctrl_fd);
+
+	if (!rx_test_flooded || !rx_test_served || replied <= 0) {
+		printf("rxFairnessTest: FAILED\n");
+		cleanup_all(-501644);
+	}
+
+	printf("rxFairnessTest: passed\n");
+	cleanup_all(CLEANUP_SUCCESS);
+}
+
+STATIC_FUNC
+void rx_test_start(void *unused)
+{
+	struct sockaddr_un unix_addr;
+	socklen_t addr_len = sizeof (unix_addr);
+	char request[] = ARG_SHOW "=" ARG_STATUS " #";
+	int32_t i;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, &rx_test_fds[0]) ||
+		socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, &rx_test_fds[2]) ||
+		(rx_test_ctrl_fd = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0 ||
+		getsockname(unix_sock, (struct sockaddr *) &unix_addr, &addr_len) ||
+		connect(rx_test_ctrl_fd, (struct sockaddr *) &unix_addr, addr_len) ||
+		write(rx_test_ctrl_fd, request, strlen(request)) < 0) {
+
+		dbg_sys(DBGT_ERR, "can't set up sockets: %s", strerror(errno));
+		cleanup_all(-501645);
+	}
+
+	fcntl(rx_test_ctrl_fd, F_SETFL, fcntl(rx_test_ctrl_fd, F_GETFL, 0) | O_NONBLOCK);
+
+	for (i = 0; i < 64; i++) {
+		if (write(rx_test_fds[1], &i, sizeof (i)) < 0)
+			break;
+	}
+
+	if (write(rx_test_fds[3], &i, sizeof (i)) < 0) {
+		dbg_sys(DBGT_ERR, "can't write: %s", strerror(errno));
+	}
+
+	// registered in this order, so epoll reports the flooded socket before the served one:
+	set_fd_hook(rx_test_fds[0], rx_test_flood_hook, ADD);
+	set_fd_hook(rx_test_fds[2], rx_test_served_hook, ADD);
+
+	task_register(1000, rx_test_check, NULL, -300617);
+}
+
+STATIC_FUNC
+int32_t opt_rx_test(uint8_t cmd, uint8_t _save, struct opt_type *opt, struct opt_parent *patch, struct ctrl_node *cn)
+{
+	// started by the main loop, once the control socket is listening and fds are dispatched:
+	if ( cmd == OPT_APPLY )
+		task_register(0, rx_test_start, NULL, -300617);
+
+	return SUCCESS;
+}
+
+
+#endif
+
+struct profile_status {
+        char *name;
+        char *type;
+        uint32_t calls;
+        uint32_t totalMs;
+        uint32_t avgUs;
+        uint32_t maxUs;
+        uint32_t lt10us;
+        uint32_t lt100us;
+        uint32_t lt1ms;
+        uint32_t lt10ms;
+        uint32_t lt100ms;
+        uint32_t ge100ms;
+};
+
+static const struct field_format profile_status_format[] = {
+        FIELD_FORMAT_INIT(FIELD_TYPE_POINTER_CHAR,      profile_status, name,        1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_POINTER_CHAR,      profile_status, type,        1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, calls,       1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, totalMs,     1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, avgUs,       1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, maxUs,       1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, lt10us,      1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, lt100us,     1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, lt1ms,       1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, lt10ms,      1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, lt100ms,     1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              profile_status, ge100ms,     1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_END
+};
+
+static int32_t profile_status_creator(struct status_handl *handl, void *data)
+{
+        struct avl_node *an = NULL;
+        struct profile_node *pn;
+        uint32_t i = 0;
+        struct profile_status *status = (struct profile_status *) (handl->data =
+                debugRealloc(handl->data, profile_tree.items * sizeof (struct profile_status), -300581));
+
+        memset(status, 0, profile_tree.items * sizeof (struct profile_status));
+
+        while ((pn = avl_iterate_item(&profile_tree, &an))) {
+
+                status[i].name = pn->name;
+                status[i].type = pn->type == PROFILE_TASK ? "task" : "fd";
+                status[i].calls = pn->calls;
+                status[i].totalMs = pn->total_us / 1000;
+                status[i].avgUs = pn->calls ? (pn->total_us / pn->calls) : 0;
+                status[i].maxUs = pn->max_us;
+                status[i].lt10us = pn->histogram[0];
+                status[i].lt100us = pn->histogram[1];
+                status[i].lt1ms = pn->histogram[2];
+                status[i].lt10ms = pn->histogram[3];
+                status[i].lt100ms = pn->histogram[4];
+                status[i].ge100ms = pn->histogram[5];
+                i++;
+        }
+
+        return profile_tree.items * sizeof (struct profile_status);
+}
+
+
+struct scheduler_status {
+        uint32_t txTasks;
+        uint32_t txDriftAvgUs;
+        uint32_t txDriftMaxUs;
+        uint32_t txLate;
+        uint32_t rxPackets;
+        uint32_t rxYields;
+};
+
+static const struct field_format scheduler_status_format[] = {
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              scheduler_status, txTasks,      1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              scheduler_status, txDriftAvgUs, 1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              scheduler_status, txDriftMaxUs, 1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              scheduler_status, txLate,       1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              scheduler_status, rxPackets,    1, FIELD_RELEVANCE_MEDI),
+        FIELD_FORMAT_INIT(FIELD_TYPE_UINT,              scheduler_status, rxYields,     1, FIELD_RELEVANCE_HIGH),
+        FIELD_FORMAT_END
+};
+
+static int32_t scheduler_status_creator(struct status_handl *handl, void *data)
+{
+        struct scheduler_status *status = (struct scheduler_status *) (handl->data =
+                debugRealloc(handl->data, sizeof (struct scheduler_status), -300591));
+
+        status->txTasks = tx_drift_stats.tasks;
+        status->txDriftAvgUs = tx_drift_stats.tasks ? (tx_drift_stats.drift_us / tx_drift_stats.tasks) : 0;
+        status->txDriftMaxUs = tx_drift_stats.drift_max_us;
+        status->txLate = tx_drift_stats.late;
+        status->rxPackets = rx_batch_stats.packets;
+        status->rxYields = rx_batch_stats.yields;
+
+        return sizeof (struct scheduler_status);
+}
+
+
+static struct opt_type schedule_options[]=
+{
+//        ord parent long_name          shrt Attributes				*ival		min		max		default		*func,*syntax,*help
+
+	{ODI,0,ARG_RX_BATCH_SIZE,	0, 9,1,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&rx_batch_size,	MIN_RX_BATCH_SIZE,MAX_RX_BATCH_SIZE,DEF_RX_BATCH_SIZE,0,	0,
+			ARG_VALUE_FORM,	"set maximum number of packets received per socket and syscall"},
+	{ODI,0,ARG_RX_BUDGET_PACKETS,	0, 9,1,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&rx_budget_packets,MIN_RX_BUDGET_PACKETS,MAX_RX_BUDGET_PACKETS,DEF_RX_BUDGET_PACKETS,0,0,
+			ARG_VALUE_FORM,	"set maximum number of packets received before checking for due tasks"},
+	{ODI,0,ARG_RX_BUDGET_TIME,	0, 9,1,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&rx_budget_time,MIN_RX_BUDGET_TIME,MAX_RX_BUDGET_TIME,DEF_RX_BUDGET_TIME,0,0,
+			ARG_VALUE_FORM,	"set maximum time in us spent on received packets and other fd events before checking for due tasks"},
+	{ODI,0,ARG_PROFILING,		0, 9,1,A_PS1,A_ADM,A_DYI,A_CFA,A_ANY,	&profiling,	0,		1,		DEF_PROFILING,0,	0,
+			ARG_VALUE_FORM,	"record call count, time, and latency histogram of each task and fd handler (see --"ARG_SHOW" "ARG_PROFILE")"}
+#ifdef SCHEDULE_TEST
+        ,
+	{ODI,0,"timerBench",  	        0, 9,0,A_PS1,A_ADM,A_INI,A_ARG,A_ANY,	&task_bench_timers,	1,	        1000000,	10000,0,	        opt_task_bench,
+			ARG_VALUE_FORM,	"benchmark task scheduling with given number of timers"},
+	{ODI,0,"timerTest",  	        0, 9,0,A_PS0,A_ADM,A_INI,A_ARG,A_ANY,	0,		0,	        0,		0,0,	        opt_task_test,
+			0,		"run expiry pass regression test of task scheduling"},
+	{ODI,0,"rxFairnessTest",  	0, 9,0,A_PS0,A_ADM,A_INI,A_ARG,A_ANY,	0,		0,	        0,		0,0,	        opt_rx_test,
+			0,		"run regression test of fd dispatching with one flooded socket"}
+#endif
+};
+
+void init_schedule( void )
+{
+	register_options_array( schedule_options, sizeof( schedule_options ), CODE_CATEGORY_NAME );
+
+        register_status_handl(sizeof (struct profile_status), 1, profile_status_format, ARG_PROFILE, profile_status_creator);
+        register_status_handl(sizeof (struct scheduler_status), 0, scheduler_status_format, ARG_SCHEDULER, scheduler_status_creator);
 }
 
 
@@ -530,8 +1313,43 @@ void cleanup_schedule( void ) {
 	
 
         struct task_node *tn;
+        struct fd_event_node *fen;
 
-        while ( (tn = list_del_head( &task_list )))
+        while ((tn = avl_first_item(&task_tree))) {
+                task_unlink(tn);
                 debugFree(tn, -300082);
-        
+        }
+
+        if (task_expired)
+                debugFree(task_expired, -300585);
+
+        task_expired = NULL;
+        task_expired_items = 0;
+        task_expired_size = 0;
+
+        if (task_heap)
+                debugFree(task_heap, -300571);
+
+        task_heap = NULL;
+        task_heap_size = 0;
+
+        struct profile_node *pn;
+
+        while ((pn = avl_remove_first_item(&profile_tree, -300582)))
+                debugFree(pn, -300583);
+
+        while ((fen = avl_first_item(&fd_event_tree)))
+                fd_event_del(fen);
+
+        fd_event_purge_zombies();
+
+        if (timer_fd > 0)
+                close(timer_fd);
+
+        if (epoll_fd > 0)
+                close(epoll_fd);
+
+        timer_fd = 0;
+        epoll_fd = 0;
+        changed_readfds = 1;
 }
@@ -18,12 +18,80 @@
 
 #define REGISTER_TASK_TIMEOUT_MAX XMIN( 100000, TIME_MAX>>2)
 
+#define TASK_HEAP_SIZE_MIN 32
+#define TASK_EXPIRED 0x80000000 // task_node.heap_pos flag: detached by the current expiry pass
 
-//void init_schedule( void );
+#define MAX_EPOLL_EVENTS 64 // max number of ready fds dispatched per epoll_wait() round
+
+#define ARG_RX_BATCH_SIZE "rxBatchSize"
+#define DEF_RX_BATCH_SIZE 16
+#define MIN_RX_BATCH_SIZE 1
+#define MAX_RX_BATCH_SIZE 32
+
+struct rx_batch_statistics {
+	uint32_t wakeups;     // rx socket events
+	uint32_t packets;     // packets received by these events
+	uint32_t packets_max; // max packets received by a single event
+	uint32_t yields;      // rounds in which fd handling yielded to due tasks or exhausted its budget
+	uint32_t drops;       // received packets discarded because their iif has been deactivated meanwhile
+};
+
+extern struct rx_batch_statistics rx_batch_stats;
+
+// fd handling (mostly rx) per wait4Event() round yields to the timers after that many packets
+// or microseconds, and in any case as soon as the next task is due:
+#define ARG_RX_BUDGET_PACKETS "rxBudgetPackets"
+#define DEF_RX_BUDGET_PACKETS 256
+#define MIN_RX_BUDGET_PACKETS 1
+#define MAX_RX_BUDGET_PACKETS 100000
+
+#define ARG_RX_BUDGET_TIME "rxBudgetTime"
+#define DEF_RX_BUDGET_TIME 10000
+#define MIN_RX_BUDGET_TIME 100
+#define MAX_RX_BUDGET_TIME 1000000
+
+#define TX_DRIFT_LATE_US 10000
+
+struct tx_drift_statistics {
+	uint32_t tasks;        // executed tx_packets() and tx_packet() tasks
+	uint64_t drift_us;     // summed delay of their execution behind the scheduled deadline
+	uint32_t drift_max_us;
+	uint32_t late;         // executed more than TX_DRIFT_LATE_US behind their deadline
+};
+
+extern struct tx_drift_statistics tx_drift_stats;
+
+#define ARG_SCHEDULER "scheduler"
+
+#define ARG_PROFILING "profiling"
+#define DEF_PROFILING 0
+#define ARG_PROFILE "profile"
+
+#define PROFILE_NAME_LEN 32
+#define PROFILE_HISTOGRAM_SIZE 6 // <10us, <100us, <1ms, <10ms, <100ms, >=100ms
+
+#define PROFILE_TASK 0
+#define PROFILE_FD   1
+
+struct profile_node {
+	void (*func) (void); // the task or fd handler function, key
+	char name[PROFILE_NAME_LEN];
+	uint8_t type;
+	uint32_t calls;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t histogram[PROFILE_HISTOGRAM_SIZE];
+};
+
+
+void init_schedule( void );
 void change_selects( void );
+void fd_event_close( int32_t fd );
 void cleanup_schedule( void );
-void task_register( TIME_T timeout, void (* task) (void *), void *data, int32_t tag );
+void _task_register( TIME_T timeout, void (* task) (void *), const char *name, void *data, int32_t tag );
+#define task_register( timeout, task, data, tag ) _task_register( (timeout), (task), #task, (data), (tag) )
 IDM_T task_remove(void (* task) (void *), void *data);
+IDM_T task_registered(void (* task) (void *), void *data);
 TIME_T task_next( void );
 void wait4Event( TIME_T timeout );
 
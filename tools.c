@@ -41,8 +41,8 @@ char* memAsHexStringSep( const void* mem, uint32_t len, uint16_t separator)
 #define MEMASSTR_STEP_SIZE 2
 #define TRAILER_LEN 4
         separator = separator ? separator : MEMASSTR_BUFF_SIZE;
-	static uint8_t c=0;
-        static char out[MEMASSTR_BUFFERS][MEMASSTR_BUFF_SIZE];
+	static __thread uint8_t c=0;
+        static __thread char out[MEMASSTR_BUFFERS][MEMASSTR_BUFF_SIZE];
         uint32_t i = 0, l = 0;
 
         if (!mem)
@@ -188,8 +188,8 @@ char* memAsCharString( const char* mem, uint32_t len)
 {
 #define MEMASSTR_BUFF_SIZE 2048
 #define MEMASSTR_BUFFERS 2
-	static uint8_t c=0;
-        static char out[MEMASSTR_BUFFERS][MEMASSTR_BUFF_SIZE];
+	static __thread uint8_t c=0;
+        static __thread char out[MEMASSTR_BUFFERS][MEMASSTR_BUFF_SIZE];
 
 
         if (!mem)